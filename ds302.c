@@ -2,6 +2,7 @@
 #include "EPOScontrol.h"
 #include "data.h"
 #include <time.h>
+#include <string.h>
 #include "ds302.h"
 
 #define DS302_DEBUG(...)    EPOS_DBG(__VA_ARGS__)
@@ -43,6 +44,7 @@ void _sm_BootSlave_doConfigurationVersionChecks(CO_Data*, UNS8);
 void _sm_BootSlave_verifyConfigurationVersion_1(CO_Data*, UNS8);
 void _sm_BootSlave_verifyConfigurationVersion_2(CO_Data*, UNS8);
 void _sm_BootSlave_downloadConfiguration(CO_Data*, UNS8);
+void _sm_BootSlave_storeConfigurationVersion(CO_Data*, UNS8);
 void _sm_BootSlave_startErrorControlService(CO_Data*, UNS8);
 void _sm_BootSlave_waitHeartbeat(CO_Data*, UNS8);
 void _sm_BootSlave_startNodeGuard(CO_Data*, UNS8);
@@ -61,18 +63,48 @@ INIT_SM_TYPE(BOOTSLAVE,_sm_BootSlave_States,SDOCallback_t,
     _sm_BootSlave_verifyConfigurationVersion_1,
     _sm_BootSlave_verifyConfigurationVersion_2,
     _sm_BootSlave_downloadConfiguration,
+    _sm_BootSlave_storeConfigurationVersion,
     _sm_BootSlave_startErrorControlService,
     _sm_BootSlave_waitHeartbeat,
     _sm_BootSlave_startNodeGuard,
     _sm_BootSlave_errorControlStarted,
     _sm_BootSlave_startSlave);
 
-// declare the master ds302_data structure
-ds302_t     ds302_data;
+// the DS-302 contexts, one per master OD (CO_Data)
+static ds302_t     _ds302_ctx[EPOS_CAN_BUSES];
+static CO_Data     *_ds302_master[EPOS_CAN_BUSES];
+
+/*
+    The DS-302 context of a master OD. The first lookup of a new CO_Data takes a free
+    context, so all the DS-302 calls for a bus must use the same CO_Data
+*/
+ds302_t *ds302_ctx (CO_Data* d)
+{
+    int     i;
+
+    for (i = 0; i < EPOS_CAN_BUSES; i++) {
+        if (_ds302_master[i] == d)
+            return &_ds302_ctx[i];
+        if (_ds302_master[i] == NULL) {
+            _ds302_master[i] = d;
+            return &_ds302_ctx[i];
+        }
+    }
+
+    return NULL;
+}
 
 
 void    _onSlaveBootCB (CO_Data*, UNS8);
 void    _onEMCY (CO_Data*, UNS8, UNS16, UNS8, const UNS8*);
+void    _onSlaveStateChange (CO_Data*, UNS8, e_nodeState);
+void    _onOperational (CO_Data*);
+void    _onHeartbeatError (CO_Data*, UNS8);
+
+void    _ds302_slave_done (CO_Data*, UNS8);
+
+/* stops a slave boot machine and lets the master machine know it finished */
+#define STOP_SLAVE_SM(d, nodeid) do { STOP_SM(ds302->_bootSlave[nodeid]); _ds302_slave_done(d, nodeid); } while (0)
 
 const char* _sm_BootSlave_CodeToText[] = {
     "INIT: Initialised, not run",
@@ -98,6 +130,7 @@ const char* _sm_BootSlave_CodeToText[] = {
 
 void _sm_BootSlave_initial(CO_Data* d, UNS8 nodeid)
 {
+    ds302_t     *ds302 = ds302_ctx (d);
     // dummy checking for 0x1F81 bit 0
 
     DS302_DEBUG("_sm_BootSlave_initial (%d)\n", nodeid);
@@ -105,25 +138,26 @@ void _sm_BootSlave_initial(CO_Data* d, UNS8 nodeid)
     if (!ds302_nl_node_in_list(d, nodeid)) {
         DS302_DEBUG("_sm_BootSlave_initial Error A (%d)\n", nodeid);
         //SM_ERROR(nodeid, SM_ErrA);
-        DATA_SM(ds302_data._bootSlave[nodeid]).result = SM_ErrA;
+        DATA_SM(ds302->_bootSlave[nodeid]).result = SM_ErrA;
         //stop the machine
-        STOP_SM(ds302_data._bootSlave[nodeid]);
+        STOP_SLAVE_SM(d, nodeid);
         return;
     } else {
         DS302_DEBUG("_sm_BootSlave_initial switch to SM_BOOTSLAVE_GET_DEVTYPE (%d)\n", nodeid);
         // go to the next state
         //SM_SWITCH_STATE(SM_BOOTSLAVE_GET_DEVTYPE,d,nodeid)
-        SWITCH_SM(ds302_data._bootSlave[nodeid], SM_BOOTSLAVE_GET_DEVTYPE, d, nodeid);
+        SWITCH_SM(ds302->_bootSlave[nodeid], SM_BOOTSLAVE_GET_DEVTYPE, d, nodeid);
         return;
     }
 }
 
 void _sm_BootSlave_getDeviceType(CO_Data* d, UNS8 nodeid)
 {
+    ds302_t     *ds302 = ds302_ctx (d);
     DS302_DEBUG("_sm_BootSlave_getDeviceType (%d)\n", nodeid);
 
     //if (SM_INITIAL(nodeid)) {
-    if (INITIAL_SM(ds302_data._bootSlave[nodeid])) {
+    if (INITIAL_SM(ds302->_bootSlave[nodeid])) {
         DS302_DEBUG("_sm_BootSlave_getDeviceType initial run (%d)\n", nodeid);
 
         // code for the first run only
@@ -137,9 +171,9 @@ void _sm_BootSlave_getDeviceType(CO_Data* d, UNS8 nodeid)
 
     // we end here on callback
 
-    UNS32	size = sizeof(DATA_SM(ds302_data._bootSlave[nodeid]).Index1000);
-    UNS8	retcode = getReadResultNetworkDict (d, nodeid, &DATA_SM(ds302_data._bootSlave[nodeid]).Index1000, &size,
-            &DATA_SM(ds302_data._bootSlave[nodeid]).errorCode);
+    UNS32	size = sizeof(DATA_SM(ds302->_bootSlave[nodeid]).Index1000);
+    UNS8	retcode = getReadResultNetworkDict (d, nodeid, &DATA_SM(ds302->_bootSlave[nodeid]).Index1000, &size,
+            &DATA_SM(ds302->_bootSlave[nodeid]).errorCode);
 
     if (retcode == SDO_UPLOAD_IN_PROGRESS || retcode == SDO_DOWNLOAD_IN_PROGRESS) {
         DS302_DEBUG("_sm_BootSlave_getDeviceType SDO op in progress (%d)\n", nodeid);
@@ -153,8 +187,8 @@ void _sm_BootSlave_getDeviceType(CO_Data* d, UNS8 nodeid)
     if(retcode != SDO_FINISHED) {
         DS302_DEBUG("_sm_BootSlave_getDeviceType SDO error (%d) = %x\n", nodeid, retcode);
         //SM_ERROR(nodeid, SM_ErrB);
-        DATA_SM(ds302_data._bootSlave[nodeid]).result = SM_ErrB;
-        STOP_SM(ds302_data._bootSlave[nodeid]);
+        DATA_SM(ds302->_bootSlave[nodeid]).result = SM_ErrB;
+        STOP_SLAVE_SM(d, nodeid);
         return;
     }
     
@@ -167,18 +201,18 @@ void _sm_BootSlave_getDeviceType(CO_Data* d, UNS8 nodeid)
     UNS32   Obj1F84;
     size = sizeof (Obj1F84);
     UNS8    dt = 0;
-    DATA_SM(ds302_data._bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F84, nodeid, &Obj1F84, &size, &dt, 0);
-    if (DATA_SM(ds302_data._bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
+    DATA_SM(ds302->_bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F84, nodeid, &Obj1F84, &size, &dt, 0);
+    if (DATA_SM(ds302->_bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
         // null out the value, it means it's unavailable. It's not a fatal error
         Obj1F84 = 0x00000000;
     }
     
     // dummy check for now
-    if (Obj1F84 != 0 && DATA_SM(ds302_data._bootSlave[nodeid]).Index1000 != Obj1F84) {
+    if (Obj1F84 != 0 && DATA_SM(ds302->_bootSlave[nodeid]).Index1000 != Obj1F84) {
             //SM_ERROR(nodeid, SM_ErrC);
             // we have a mismatch in the Device Type values from expected
-            DATA_SM(ds302_data._bootSlave[nodeid]).result = SM_ErrC;
-            STOP_SM(ds302_data._bootSlave[nodeid]);
+            DATA_SM(ds302->_bootSlave[nodeid]).result = SM_ErrC;
+            STOP_SLAVE_SM(d, nodeid);
             return;
     } else {
         // everything OK, see if we need to check IDs or not
@@ -188,29 +222,29 @@ void _sm_BootSlave_getDeviceType(CO_Data* d, UNS8 nodeid)
         UNS32   Obj1F88;
         
         size = sizeof (Obj1F85);
-        DATA_SM(ds302_data._bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F85, nodeid, &Obj1F85, &size, &dt, 0);
-        if (DATA_SM(ds302_data._bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
+        DATA_SM(ds302->_bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F85, nodeid, &Obj1F85, &size, &dt, 0);
+        if (DATA_SM(ds302->_bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
             // null out the value, it means it's unavailable. It's not a fatal error
             Obj1F85 = 0x00000000;
         }
 
         size = sizeof (Obj1F86);
-        DATA_SM(ds302_data._bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F86, nodeid, &Obj1F86, &size, &dt, 0);
-        if (DATA_SM(ds302_data._bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
+        DATA_SM(ds302->_bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F86, nodeid, &Obj1F86, &size, &dt, 0);
+        if (DATA_SM(ds302->_bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
             // null out the value, it means it's unavailable. It's not a fatal error
             Obj1F86 = 0x00000000;
         }
 
         size = sizeof (Obj1F87);
-        DATA_SM(ds302_data._bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F87, nodeid, &Obj1F87, &size, &dt, 0);
-        if (DATA_SM(ds302_data._bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
+        DATA_SM(ds302->_bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F87, nodeid, &Obj1F87, &size, &dt, 0);
+        if (DATA_SM(ds302->_bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
             // null out the value, it means it's unavailable. It's not a fatal error
             Obj1F87 = 0x00000000;
         }
 
         size = sizeof (Obj1F88);
-        DATA_SM(ds302_data._bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F88, nodeid, &Obj1F88, &size, &dt, 0);
-        if (DATA_SM(ds302_data._bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
+        DATA_SM(ds302->_bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F88, nodeid, &Obj1F88, &size, &dt, 0);
+        if (DATA_SM(ds302->_bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
             // null out the value, it means it's unavailable. It's not a fatal error
             Obj1F88 = 0x00000000;
         }
@@ -219,12 +253,12 @@ void _sm_BootSlave_getDeviceType(CO_Data* d, UNS8 nodeid)
         if (Obj1F85 || Obj1F86 || Obj1F87 || Obj1F88) {
             // switch to pulling the IDs
             //SM_SWITCH_STATE(SM_BOOTSLAVE_GET_ID1,d,nodeid)
-            SWITCH_SM(ds302_data._bootSlave[nodeid], SM_BOOTSLAVE_GET_ID1, d, nodeid);
+            SWITCH_SM(ds302->_bootSlave[nodeid], SM_BOOTSLAVE_GET_ID1, d, nodeid);
             return;
         } else {
             // skip pulling the IDs chain
             //SM_SWITCH_STATE(SM_BOOTSLAVE_DECIDE_BC,d,nodeid)
-            SWITCH_SM(ds302_data._bootSlave[nodeid], SM_BOOTSLAVE_DECIDE_BC, d, nodeid);
+            SWITCH_SM(ds302->_bootSlave[nodeid], SM_BOOTSLAVE_DECIDE_BC, d, nodeid);
             return;
         }
     }
@@ -232,9 +266,10 @@ void _sm_BootSlave_getDeviceType(CO_Data* d, UNS8 nodeid)
 
 void _sm_BootSlave_getIdentification_1(CO_Data* d, UNS8 nodeid)
 {
+    ds302_t     *ds302 = ds302_ctx (d);
     DS302_DEBUG("_sm_BootSlave_getIdentification_1\n");
 
-    if (INITIAL_SM(ds302_data._bootSlave[nodeid])) {
+    if (INITIAL_SM(ds302->_bootSlave[nodeid])) {
         DS302_DEBUG("_sm_BootSlave_getIdentification_1 initial call\n");
 
         // code for the first run only  
@@ -249,9 +284,9 @@ void _sm_BootSlave_getIdentification_1(CO_Data* d, UNS8 nodeid)
 
     // we end here on callback
 
-    UNS32   size = sizeof(DATA_SM(ds302_data._bootSlave[nodeid]).Index1018_1);
-    UNS8    retcode = getReadResultNetworkDict (d, nodeid, &DATA_SM(ds302_data._bootSlave[nodeid]).Index1018_1, &size,
-            &DATA_SM(ds302_data._bootSlave[nodeid]).errorCode);
+    UNS32   size = sizeof(DATA_SM(ds302->_bootSlave[nodeid]).Index1018_1);
+    UNS8    retcode = getReadResultNetworkDict (d, nodeid, &DATA_SM(ds302->_bootSlave[nodeid]).Index1018_1, &size,
+            &DATA_SM(ds302->_bootSlave[nodeid]).errorCode);
 
     if (retcode == SDO_UPLOAD_IN_PROGRESS || retcode == SDO_DOWNLOAD_IN_PROGRESS)
             // do nothing, outside of callback call
@@ -262,38 +297,39 @@ void _sm_BootSlave_getIdentification_1(CO_Data* d, UNS8 nodeid)
 
     if(retcode != SDO_FINISHED) {
             //SM_ERROR(nodeid, SM_ErrD);
-            DATA_SM(ds302_data._bootSlave[nodeid]).result = SM_ErrD;
-            STOP_SM(ds302_data._bootSlave[nodeid]);
+            DATA_SM(ds302->_bootSlave[nodeid]).result = SM_ErrD;
+            STOP_SLAVE_SM(d, nodeid);
             return;
     }    
     
     UNS32   Obj1F85;
     UNS8    dt = 0;
     size = sizeof (Obj1F85);
-    DATA_SM(ds302_data._bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F85, nodeid, &Obj1F85, &size, &dt, 0);
-    if (DATA_SM(ds302_data._bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
+    DATA_SM(ds302->_bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F85, nodeid, &Obj1F85, &size, &dt, 0);
+    if (DATA_SM(ds302->_bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
         // null out the value, it means it's unavailable. It's not a fatal error
         Obj1F85 = 0x00000000;
     }
     
     // verify against required data in 0x1F85
-    if (Obj1F85 != 0 && DATA_SM(ds302_data._bootSlave[nodeid]).Index1018_1 != Obj1F85) {
+    if (Obj1F85 != 0 && DATA_SM(ds302->_bootSlave[nodeid]).Index1018_1 != Obj1F85) {
         // mismatch, stop process
         //SM_ERROR(nodeid, SM_ErrD);
-        DATA_SM(ds302_data._bootSlave[nodeid]).result = SM_ErrD;
-        STOP_SM(ds302_data._bootSlave[nodeid]);
+        DATA_SM(ds302->_bootSlave[nodeid]).result = SM_ErrD;
+        STOP_SLAVE_SM(d, nodeid);
         return;
     } else {
         // go to the next one
         //SM_SWITCH_STATE(SM_BOOTSLAVE_GET_ID2,d,nodeid)
-        SWITCH_SM(ds302_data._bootSlave[nodeid], SM_BOOTSLAVE_GET_ID2, d, nodeid);
+        SWITCH_SM(ds302->_bootSlave[nodeid], SM_BOOTSLAVE_GET_ID2, d, nodeid);
         return;
     }
 }
 
 void _sm_BootSlave_getIdentification_2(CO_Data* d, UNS8 nodeid)
 {
-    if (INITIAL_SM(ds302_data._bootSlave[nodeid])) {      
+    ds302_t     *ds302 = ds302_ctx (d);
+    if (INITIAL_SM(ds302->_bootSlave[nodeid])) {      
         // code for the first run only  
         // read 0x1018 0x02                       
         // self callback      
@@ -304,9 +340,9 @@ void _sm_BootSlave_getIdentification_2(CO_Data* d, UNS8 nodeid)
 
     // we end here on callback
 
-    UNS32   size = sizeof(DATA_SM(ds302_data._bootSlave[nodeid]).Index1018_2);
-    UNS8    retcode = getReadResultNetworkDict (d, nodeid, &DATA_SM(ds302_data._bootSlave[nodeid]).Index1018_2, &size, 
-            &DATA_SM(ds302_data._bootSlave[nodeid]).errorCode);
+    UNS32   size = sizeof(DATA_SM(ds302->_bootSlave[nodeid]).Index1018_2);
+    UNS8    retcode = getReadResultNetworkDict (d, nodeid, &DATA_SM(ds302->_bootSlave[nodeid]).Index1018_2, &size, 
+            &DATA_SM(ds302->_bootSlave[nodeid]).errorCode);
 
     if (retcode == SDO_UPLOAD_IN_PROGRESS || retcode == SDO_DOWNLOAD_IN_PROGRESS)
         // do nothing, outside of callback call
@@ -317,38 +353,39 @@ void _sm_BootSlave_getIdentification_2(CO_Data* d, UNS8 nodeid)
         
     if(retcode != SDO_FINISHED) {
         //SM_ERROR(nodeid, SM_ErrM);
-        DATA_SM(ds302_data._bootSlave[nodeid]).result = SM_ErrM;
-        STOP_SM(ds302_data._bootSlave[nodeid]);
+        DATA_SM(ds302->_bootSlave[nodeid]).result = SM_ErrM;
+        STOP_SLAVE_SM(d, nodeid);
         return;
     }
 
     UNS32   Obj1F86;
     UNS8    dt = 0;
     size = sizeof (Obj1F86);
-    DATA_SM(ds302_data._bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F86, nodeid, &Obj1F86, &size, &dt, 0);
-    if (DATA_SM(ds302_data._bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
+    DATA_SM(ds302->_bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F86, nodeid, &Obj1F86, &size, &dt, 0);
+    if (DATA_SM(ds302->_bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
         // null out the value, it means it's unavailable. It's not a fatal error
         Obj1F86 = 0x00000000;
     }
     
     // verify against required data in 0x1F86
-    if (Obj1F86 != 0 && DATA_SM(ds302_data._bootSlave[nodeid]).Index1018_2 != Obj1F86) {
+    if (Obj1F86 != 0 && DATA_SM(ds302->_bootSlave[nodeid]).Index1018_2 != Obj1F86) {
         // mismatch, stop process
         // SM_ERROR(nodeid, SM_ErrM);
-        DATA_SM(ds302_data._bootSlave[nodeid]).result = SM_ErrM;
-        STOP_SM(ds302_data._bootSlave[nodeid]);
+        DATA_SM(ds302->_bootSlave[nodeid]).result = SM_ErrM;
+        STOP_SLAVE_SM(d, nodeid);
         return;
     } else {                               
         // go to the next one               
         //SM_SWITCH_STATE(SM_BOOTSLAVE_GET_ID3,d,nodeid)
-        SWITCH_SM(ds302_data._bootSlave[nodeid], SM_BOOTSLAVE_GET_ID3, d, nodeid);
+        SWITCH_SM(ds302->_bootSlave[nodeid], SM_BOOTSLAVE_GET_ID3, d, nodeid);
         return;
     }
 }
 
 void _sm_BootSlave_getIdentification_3(CO_Data* d, UNS8 nodeid)
 {
-    if (INITIAL_SM(ds302_data._bootSlave[nodeid])) {      
+    ds302_t     *ds302 = ds302_ctx (d);
+    if (INITIAL_SM(ds302->_bootSlave[nodeid])) {      
         // code for the first run only  
         // read 0x1018 0x03                       
         // self callback      
@@ -359,9 +396,9 @@ void _sm_BootSlave_getIdentification_3(CO_Data* d, UNS8 nodeid)
 
     // we end here on callback
 
-    UNS32   size = sizeof(DATA_SM(ds302_data._bootSlave[nodeid]).Index1018_3);
-    UNS8    retcode = getReadResultNetworkDict (d, nodeid, &DATA_SM(ds302_data._bootSlave[nodeid]).Index1018_3, &size, 
-            &DATA_SM(ds302_data._bootSlave[nodeid]).errorCode);
+    UNS32   size = sizeof(DATA_SM(ds302->_bootSlave[nodeid]).Index1018_3);
+    UNS8    retcode = getReadResultNetworkDict (d, nodeid, &DATA_SM(ds302->_bootSlave[nodeid]).Index1018_3, &size, 
+            &DATA_SM(ds302->_bootSlave[nodeid]).errorCode);
 
     if (retcode == SDO_UPLOAD_IN_PROGRESS || retcode == SDO_DOWNLOAD_IN_PROGRESS)
         // do nothing, outside of callback call
@@ -372,38 +409,39 @@ void _sm_BootSlave_getIdentification_3(CO_Data* d, UNS8 nodeid)
 
     if(retcode != SDO_FINISHED) {
         // SM_ERROR(nodeid, SM_ErrN);
-        DATA_SM(ds302_data._bootSlave[nodeid]).result = SM_ErrN;
-        STOP_SM(ds302_data._bootSlave[nodeid]);
+        DATA_SM(ds302->_bootSlave[nodeid]).result = SM_ErrN;
+        STOP_SLAVE_SM(d, nodeid);
         return;
     }
 
     UNS32   Obj1F87;
     UNS8    dt = 0;
     size = sizeof (Obj1F87);
-    DATA_SM(ds302_data._bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F87, nodeid, &Obj1F87, &size, &dt, 0);
-    if (DATA_SM(ds302_data._bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
+    DATA_SM(ds302->_bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F87, nodeid, &Obj1F87, &size, &dt, 0);
+    if (DATA_SM(ds302->_bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
         // null out the value, it means it's unavailable. It's not a fatal error
         Obj1F87 = 0x00000000;
     }
     
     // verify against required data in 0x1F87
-    if (Obj1F87 != 0 && DATA_SM(ds302_data._bootSlave[nodeid]).Index1018_3 != Obj1F87) {
+    if (Obj1F87 != 0 && DATA_SM(ds302->_bootSlave[nodeid]).Index1018_3 != Obj1F87) {
         // mismatch, stop process
         //SM_ERROR(nodeid, SM_ErrN);
-        DATA_SM(ds302_data._bootSlave[nodeid]).result = SM_ErrN;
-        STOP_SM(ds302_data._bootSlave[nodeid]);
+        DATA_SM(ds302->_bootSlave[nodeid]).result = SM_ErrN;
+        STOP_SLAVE_SM(d, nodeid);
         return;
     } else {                               
         // go to the next one               
         //SM_SWITCH_STATE(SM_BOOTSLAVE_GET_ID4,d,nodeid)
-        SWITCH_SM(ds302_data._bootSlave[nodeid], SM_BOOTSLAVE_GET_ID4, d, nodeid);
+        SWITCH_SM(ds302->_bootSlave[nodeid], SM_BOOTSLAVE_GET_ID4, d, nodeid);
         return;
     }
 }
 
 void _sm_BootSlave_getIdentification_4(CO_Data* d, UNS8 nodeid)
 {
-    if (INITIAL_SM(ds302_data._bootSlave[nodeid])) {      
+    ds302_t     *ds302 = ds302_ctx (d);
+    if (INITIAL_SM(ds302->_bootSlave[nodeid])) {      
         // code for the first run only  
         // read 0x1018 0x04                       
         // self callback      
@@ -414,9 +452,9 @@ void _sm_BootSlave_getIdentification_4(CO_Data* d, UNS8 nodeid)
 
     // we end here on callback
 
-    UNS32   size = sizeof(DATA_SM(ds302_data._bootSlave[nodeid]).Index1018_4);
-    UNS8    retcode = getReadResultNetworkDict (d, nodeid, &DATA_SM(ds302_data._bootSlave[nodeid]).Index1018_4, &size, 
-            &DATA_SM(ds302_data._bootSlave[nodeid]).errorCode);
+    UNS32   size = sizeof(DATA_SM(ds302->_bootSlave[nodeid]).Index1018_4);
+    UNS8    retcode = getReadResultNetworkDict (d, nodeid, &DATA_SM(ds302->_bootSlave[nodeid]).Index1018_4, &size, 
+            &DATA_SM(ds302->_bootSlave[nodeid]).errorCode);
 
     if (retcode == SDO_UPLOAD_IN_PROGRESS || retcode == SDO_DOWNLOAD_IN_PROGRESS)
         // do nothing, outside of callback call
@@ -427,51 +465,53 @@ void _sm_BootSlave_getIdentification_4(CO_Data* d, UNS8 nodeid)
 
     if(retcode != SDO_FINISHED) {
         // SM_ERROR(nodeid, SM_ErrO);
-        DATA_SM(ds302_data._bootSlave[nodeid]).result = SM_ErrO;
-        STOP_SM(ds302_data._bootSlave[nodeid]);
+        DATA_SM(ds302->_bootSlave[nodeid]).result = SM_ErrO;
+        STOP_SLAVE_SM(d, nodeid);
         return;
     }
 
     UNS32   Obj1F88;
     UNS8    dt = 0;
     size = sizeof (Obj1F88);
-    DATA_SM(ds302_data._bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F88, nodeid, &Obj1F88, &size, &dt, 0);
-    if (DATA_SM(ds302_data._bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
+    DATA_SM(ds302->_bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F88, nodeid, &Obj1F88, &size, &dt, 0);
+    if (DATA_SM(ds302->_bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
         // null out the value, it means it's unavailable. It's not a fatal error
         Obj1F88 = 0x00000000;
     }
     
     // verify against required data in 0x1F88
-    if (Obj1F88 != 0 && DATA_SM(ds302_data._bootSlave[nodeid]).Index1018_4 != Obj1F88) {
+    if (Obj1F88 != 0 && DATA_SM(ds302->_bootSlave[nodeid]).Index1018_4 != Obj1F88) {
         // mismatch, stop process
         //SM_ERROR(nodeid, SM_ErrO);
-        DATA_SM(ds302_data._bootSlave[nodeid]).result = SM_ErrO;
-        STOP_SM(ds302_data._bootSlave[nodeid]);
+        DATA_SM(ds302->_bootSlave[nodeid]).result = SM_ErrO;
+        STOP_SLAVE_SM(d, nodeid);
         return;
     } else {                               
         // go to the next one               
         //SM_SWITCH_STATE(SM_BOOTSLAVE_DECIDE_BC,d,nodeid)
-        SWITCH_SM(ds302_data._bootSlave[nodeid], SM_BOOTSLAVE_DECIDE_BC, d, nodeid);
+        SWITCH_SM(ds302->_bootSlave[nodeid], SM_BOOTSLAVE_DECIDE_BC, d, nodeid);
         return;
     }
 }
 
 void _sm_BootSlave_decideBCPath(CO_Data* d, UNS8 nodeid)
 {
+    ds302_t     *ds302 = ds302_ctx (d);
     DS302_DEBUG("_sm_BootSlave_decideBCPath\n");
-    if (INITIAL_SM(ds302_data._bootSlave[nodeid])) {      
+    if (INITIAL_SM(ds302->_bootSlave[nodeid])) {      
         // code for the first run only
         // switch to path C, path B is not implemented yet
         // SM_SWITCH_STATE(SM_BOOTSLAVE_DO_CONFVER_CHECK,d,nodeid)
-        SWITCH_SM (ds302_data._bootSlave[nodeid], SM_BOOTSLAVE_DO_CONFVER_CHECK, d, nodeid);
+        SWITCH_SM (ds302->_bootSlave[nodeid], SM_BOOTSLAVE_DO_CONFVER_CHECK, d, nodeid);
         return;
     }	
 }
 
 void _sm_BootSlave_doConfigurationVersionChecks(CO_Data* d, UNS8 nodeid)
 {
+    ds302_t     *ds302 = ds302_ctx (d);
     DS302_DEBUG("_sm_BootSlave_doConfigurationVersionChecks\n");
-    if (INITIAL_SM(ds302_data._bootSlave[nodeid])) {      
+    if (INITIAL_SM(ds302->_bootSlave[nodeid])) {      
         // code for the first run only  
        
         // see if we have 0x1F26 and 0x1F27 defined in the config for the node
@@ -481,29 +521,47 @@ void _sm_BootSlave_doConfigurationVersionChecks(CO_Data* d, UNS8 nodeid)
         UNS32   size;
         UNS8    dt = 0;
         size = sizeof (Obj1F26);
-        DATA_SM(ds302_data._bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F26, nodeid, &Obj1F26, &size, &dt, 0);
-        if (DATA_SM(ds302_data._bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
+        DATA_SM(ds302->_bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F26, nodeid, &Obj1F26, &size, &dt, 0);
+        if (DATA_SM(ds302->_bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
             // null out the value, it means it's unavailable. It's not a fatal error
             Obj1F26 = 0x00000000;
         }
 
         UNS32   Obj1F27;
         size = sizeof (Obj1F27);
-        DATA_SM(ds302_data._bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F27, nodeid, &Obj1F27, &size, &dt, 0);
-        if (DATA_SM(ds302_data._bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
+        DATA_SM(ds302->_bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F27, nodeid, &Obj1F27, &size, &dt, 0);
+        if (DATA_SM(ds302->_bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
             // null out the value, it means it's unavailable. It's not a fatal error
             Obj1F27 = 0x00000000;
         }
-                
+
+        if (Obj1F26 == 0 || Obj1F27 == 0) {
+            // no expected version set, use the hash of the DCF we would download
+            // it is written to 0x1020 after a download, so an unchanged slave skips the next one
+            const indextable *  Object1F22;
+            UNS32               errorCode;
+
+            Object1F22 = (*d->scanIndexOD)(d, 0x1F22, &errorCode);
+            if (errorCode == OD_SUCCESSFUL && nodeid < Object1F22->bSubCount) {
+                UNS32   dcfLength = ds302_dcf_length (Object1F22->pSubindex[nodeid].pObject, Object1F22->pSubindex[nodeid].size);
+                if (dcfLength > 4)
+                    ds302_dcf_hash (Object1F22->pSubindex[nodeid].pObject, dcfLength, &Obj1F26, &Obj1F27);
+            }
+        }
+
+        DATA_SM(ds302->_bootSlave[nodeid]).Expected1020_1 = Obj1F26;
+        DATA_SM(ds302->_bootSlave[nodeid]).Expected1020_2 = Obj1F27;
+        DS302_DEBUG("Slave %d expected configuration version %08x/%08x\n", nodeid, Obj1F26, Obj1F27);
+
         if (Obj1F26 == 0 || Obj1F27 == 0) {
             // we don't have the values, go straight to download
             //SM_SWITCH_STATE(SM_BOOTSLAVE_DOWNLOAD_CONFIG,d,nodeid)
-            SWITCH_SM (ds302_data._bootSlave[nodeid], SM_BOOTSLAVE_DOWNLOAD_CONFIG, d, nodeid);
+            SWITCH_SM (ds302->_bootSlave[nodeid], SM_BOOTSLAVE_DOWNLOAD_CONFIG, d, nodeid);
             return;
         } else {
             // we have the values, get them and compare them
             //SM_SWITCH_STATE(SM_BOOTSLAVE_VERIFY_CONFVER_1,d,nodeid)
-            SWITCH_SM (ds302_data._bootSlave[nodeid], SM_BOOTSLAVE_VERIFY_CONFVER_1, d, nodeid);
+            SWITCH_SM (ds302->_bootSlave[nodeid], SM_BOOTSLAVE_VERIFY_CONFVER_1, d, nodeid);
             return;
         }
     }  
@@ -511,8 +569,9 @@ void _sm_BootSlave_doConfigurationVersionChecks(CO_Data* d, UNS8 nodeid)
 
 void _sm_BootSlave_verifyConfigurationVersion_1(CO_Data* d, UNS8 nodeid)
 {
+    ds302_t     *ds302 = ds302_ctx (d);
     DS302_DEBUG("_sm_BootSlave_verifyConfigurationVersion_1\n");
-    if (INITIAL_SM(ds302_data._bootSlave[nodeid])) {      
+    if (INITIAL_SM(ds302->_bootSlave[nodeid])) {      
         // code for the first run only  
         // read 0x1020 0x01           
         // self callback      
@@ -523,9 +582,9 @@ void _sm_BootSlave_verifyConfigurationVersion_1(CO_Data* d, UNS8 nodeid)
 
     // we end here on callback
 
-    UNS32   size = sizeof(DATA_SM(ds302_data._bootSlave[nodeid]).Index1020_1);
-    UNS8    retcode = getReadResultNetworkDict (d, nodeid, &DATA_SM(ds302_data._bootSlave[nodeid]).Index1020_1, &size, 
-            &DATA_SM(ds302_data._bootSlave[nodeid]).errorCode);
+    UNS32   size = sizeof(DATA_SM(ds302->_bootSlave[nodeid]).Index1020_1);
+    UNS8    retcode = getReadResultNetworkDict (d, nodeid, &DATA_SM(ds302->_bootSlave[nodeid]).Index1020_1, &size, 
+            &DATA_SM(ds302->_bootSlave[nodeid]).errorCode);
 
     if (retcode == SDO_UPLOAD_IN_PROGRESS || retcode == SDO_DOWNLOAD_IN_PROGRESS)
         // do nothing, outside of callback call
@@ -536,38 +595,32 @@ void _sm_BootSlave_verifyConfigurationVersion_1(CO_Data* d, UNS8 nodeid)
         // SM_ERROR(nodeid, SM_ErrO);
         // set the data to -1 to indicate failure to retrieve
         //SM_DATA(nodeid,Index1020_1) = -1;
-        DATA_SM(ds302_data._bootSlave[nodeid]).Index1020_1 = -1;
+        DATA_SM(ds302->_bootSlave[nodeid]).Index1020_1 = -1;
     }
     /* Finalise last SDO transfer with this node */
     closeSDOtransfer(d, nodeid, SDO_CLIENT);  
 
-    UNS32   Obj1F26;
-    UNS8    dt = 0;
-    size = sizeof (Obj1F26);
-    DATA_SM(ds302_data._bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F26, nodeid, &Obj1F26, &size, &dt, 0);
-    if (DATA_SM(ds302_data._bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
-        // null out the value, it means it's unavailable. It's not a fatal error
-        Obj1F26 = 0x00000000;
-    }    
+    UNS32   Obj1F26 = DATA_SM(ds302->_bootSlave[nodeid]).Expected1020_1;
 
-    // verify against required data in 0x1F26
-    if (Obj1F26 && DATA_SM(ds302_data._bootSlave[nodeid]).Index1020_1 != Obj1F26) {                  
+    // verify against the expected data (0x1F26 or the DCF hash)
+    if (Obj1F26 && DATA_SM(ds302->_bootSlave[nodeid]).Index1020_1 != Obj1F26) {                  
         // mismatch, go directly to download
         //SM_SWITCH_STATE(SM_BOOTSLAVE_DOWNLOAD_CONFIG,d,nodeid)
-        SWITCH_SM (ds302_data._bootSlave[nodeid], SM_BOOTSLAVE_DOWNLOAD_CONFIG, d, nodeid);
+        SWITCH_SM (ds302->_bootSlave[nodeid], SM_BOOTSLAVE_DOWNLOAD_CONFIG, d, nodeid);
         return;
     } else {                               
         // go to the next one               
         //SM_SWITCH_STATE(SM_BOOTSLAVE_VERIFY_CONFVER_2,d,nodeid)
-        SWITCH_SM (ds302_data._bootSlave[nodeid], SM_BOOTSLAVE_VERIFY_CONFVER_2, d, nodeid);
+        SWITCH_SM (ds302->_bootSlave[nodeid], SM_BOOTSLAVE_VERIFY_CONFVER_2, d, nodeid);
         return;
     }
 }
 
 void _sm_BootSlave_verifyConfigurationVersion_2(CO_Data* d, UNS8 nodeid)
 {
+    ds302_t     *ds302 = ds302_ctx (d);
     DS302_DEBUG("_sm_BootSlave_verifyConfigurationVersion_2\n");
-    if (INITIAL_SM(ds302_data._bootSlave[nodeid])) {      
+    if (INITIAL_SM(ds302->_bootSlave[nodeid])) {      
         // code for the first run only         
         // read 0x1020 0x02 
         // self callback      
@@ -578,9 +631,9 @@ void _sm_BootSlave_verifyConfigurationVersion_2(CO_Data* d, UNS8 nodeid)
 
     // we end here on callback
 
-    UNS32   size = sizeof(DATA_SM(ds302_data._bootSlave[nodeid]).Index1020_2); 
-    UNS8    retcode = getReadResultNetworkDict (d, nodeid, &DATA_SM(ds302_data._bootSlave[nodeid]).Index1020_2, &size, 
-            &DATA_SM(ds302_data._bootSlave[nodeid]).errorCode);
+    UNS32   size = sizeof(DATA_SM(ds302->_bootSlave[nodeid]).Index1020_2); 
+    UNS8    retcode = getReadResultNetworkDict (d, nodeid, &DATA_SM(ds302->_bootSlave[nodeid]).Index1020_2, &size, 
+            &DATA_SM(ds302->_bootSlave[nodeid]).errorCode);
 
     if (retcode == SDO_UPLOAD_IN_PROGRESS || retcode == SDO_DOWNLOAD_IN_PROGRESS)
         // do nothing, outside of callback call
@@ -591,40 +644,34 @@ void _sm_BootSlave_verifyConfigurationVersion_2(CO_Data* d, UNS8 nodeid)
         // SM_ERROR(nodeid, SM_ErrO);     
         // set the data to -1 to indicate failure to retrieve
         //SM_DATA(nodeid,Index1020_2) = -1;
-        DATA_SM(ds302_data._bootSlave[nodeid]).Index1020_2 = -1;
+        DATA_SM(ds302->_bootSlave[nodeid]).Index1020_2 = -1;
     }
     /* Finalise last SDO transfer with this node */
     closeSDOtransfer(d, nodeid, SDO_CLIENT);  
 
-    UNS32   Obj1F27;
-    UNS8    dt = 0;
-    size = sizeof (Obj1F27);
-    DATA_SM(ds302_data._bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F27, nodeid, &Obj1F27, &size, &dt, 0);
-    if (DATA_SM(ds302_data._bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
-        // null out the value, it means it's unavailable. It's not a fatal error
-        Obj1F27 = 0x00000000;
-    }
-        
-    // verify against required data in 0x1F27
-    if (Obj1F27 && DATA_SM(ds302_data._bootSlave[nodeid]).Index1020_2 != Obj1F27) {
+    UNS32   Obj1F27 = DATA_SM(ds302->_bootSlave[nodeid]).Expected1020_2;
+
+    // verify against the expected data (0x1F27 or the DCF hash)
+    if (Obj1F27 && DATA_SM(ds302->_bootSlave[nodeid]).Index1020_2 != Obj1F27) {
         // mismatch, go directly to download
         //SM_SWITCH_STATE(SM_BOOTSLAVE_DOWNLOAD_CONFIG,d,nodeid)
-        SWITCH_SM (ds302_data._bootSlave[nodeid], SM_BOOTSLAVE_DOWNLOAD_CONFIG, d, nodeid);
+        SWITCH_SM (ds302->_bootSlave[nodeid], SM_BOOTSLAVE_DOWNLOAD_CONFIG, d, nodeid);
         return;
     } else {                               
         // configuration is at the exepected levels, skip configuration download
         // go to start error control services   
         //SM_SWITCH_STATE(SM_BOOTSLAVE_START_ERRCTL,d,nodeid)
-        SWITCH_SM (ds302_data._bootSlave[nodeid], SM_BOOTSLAVE_START_ERRCTL, d, nodeid);
+        SWITCH_SM (ds302->_bootSlave[nodeid], SM_BOOTSLAVE_START_ERRCTL, d, nodeid);
         return;
     }
 }
 
 void _sm_BootSlave_downloadConfiguration(CO_Data* d, UNS8 nodeid)
 {
+    ds302_t     *ds302 = ds302_ctx (d);
     DS302_DEBUG("_sm_BootSlave_downloadConfiguration\n");
     //// this is dummy for now. Doesn't do anything other than keep the SM functioning correctly
-    if (INITIAL_SM(ds302_data._bootSlave[nodeid])) {
+    if (INITIAL_SM(ds302->_bootSlave[nodeid])) {
         // code for the first run only
         DS302_DEBUG("ConciseDCF initialization for slave %d\n", nodeid);
         // initialises the DCF pointers and data
@@ -635,8 +682,8 @@ void _sm_BootSlave_downloadConfiguration(CO_Data* d, UNS8 nodeid)
         Object1F22 = (*d->scanIndexOD)(d, 0x1F22, &errorCode);
         if (errorCode != OD_SUCCESSFUL) {
             DS302_DEBUG("ConciseDCF for %d: can not get data for 0x1F22\n", nodeid);
-            DATA_SM(ds302_data._bootSlave[nodeid]).result = SM_ErrJ;
-            STOP_SM(ds302_data._bootSlave[nodeid]);
+            DATA_SM(ds302->_bootSlave[nodeid]).result = SM_ErrJ;
+            STOP_SLAVE_SM(d, nodeid);
             return;
         }
 
@@ -644,42 +691,91 @@ void _sm_BootSlave_downloadConfiguration(CO_Data* d, UNS8 nodeid)
         if (!(nodeid < Object1F22->bSubCount)) {
             // problem, no data
             DS302_DEBUG("ConciseDCF for %d: data for 0x1F22 does not include this slave (%d subcount)\n", nodeid, Object1F22->bSubCount);
-            DATA_SM(ds302_data._bootSlave[nodeid]).result = SM_ErrJ;
-            STOP_SM(ds302_data._bootSlave[nodeid]);
+            DATA_SM(ds302->_bootSlave[nodeid]).result = SM_ErrJ;
+            STOP_SLAVE_SM(d, nodeid);
             return;
         }
         
         // get the raw data
-        DATA_SM(ds302_data._bootSlave[nodeid]).dcfData = Object1F22->pSubindex[nodeid].pObject;
-        DATA_SM(ds302_data._bootSlave[nodeid]).dcfSize = Object1F22->pSubindex[nodeid].size;
-        DATA_SM(ds302_data._bootSlave[nodeid]).dcfCursor = 4; // see below why 4
-        DATA_SM(ds302_data._bootSlave[nodeid]).dcfState = 0;
+        DATA_SM(ds302->_bootSlave[nodeid]).dcfData = Object1F22->pSubindex[nodeid].pObject;
+        DATA_SM(ds302->_bootSlave[nodeid]).dcfSize = Object1F22->pSubindex[nodeid].size;
+        DATA_SM(ds302->_bootSlave[nodeid]).dcfCursor = 4; // see below why 4
+        DATA_SM(ds302->_bootSlave[nodeid]).dcfState = 0;
         
         // why 4? Because DCF data is UNS32 number of entries and then idx/subidx/datasize/data ... 4 means we have at least the size
-        if (DATA_SM(ds302_data._bootSlave[nodeid]).dcfData == NULL || DATA_SM(ds302_data._bootSlave[nodeid]).dcfSize < 4) {
+        if (DATA_SM(ds302->_bootSlave[nodeid]).dcfData == NULL || DATA_SM(ds302->_bootSlave[nodeid]).dcfSize < 4) {
             // problem, empty data
             // is this a problem? Not having DCF data? Maybe we don't want to configure this slave?
             DS302_DEBUG("ConciseDCF for %d: data for 0x1F22 does not include this slave (empty data)\n", nodeid);
-            DATA_SM(ds302_data._bootSlave[nodeid]).result = SM_ErrJ;
-            STOP_SM(ds302_data._bootSlave[nodeid]);
+            DATA_SM(ds302->_bootSlave[nodeid]).result = SM_ErrJ;
+            STOP_SLAVE_SM(d, nodeid);
             return;
         }
         
         // get the DCF count
-        DATA_SM(ds302_data._bootSlave[nodeid]).dcfCount = DATA_SM(ds302_data._bootSlave[nodeid]).dcfData[0] | 
-            DATA_SM(ds302_data._bootSlave[nodeid]).dcfData[1]<<8 | 
-            DATA_SM(ds302_data._bootSlave[nodeid]).dcfData[2]<<16 | 
-            DATA_SM(ds302_data._bootSlave[nodeid]).dcfData[3]<<24;
+        DATA_SM(ds302->_bootSlave[nodeid]).dcfCount = DATA_SM(ds302->_bootSlave[nodeid]).dcfData[0] | 
+            DATA_SM(ds302->_bootSlave[nodeid]).dcfData[1]<<8 | 
+            DATA_SM(ds302->_bootSlave[nodeid]).dcfData[2]<<16 | 
+            DATA_SM(ds302->_bootSlave[nodeid]).dcfData[3]<<24;
             
-        DATA_SM(ds302_data._bootSlave[nodeid]).dcfLoadCount = 0;
-        DS302_DEBUG("ConciseDCF for %d: initialised OK with %d entries to load\n", nodeid, DATA_SM(ds302_data._bootSlave[nodeid]).dcfCount);
+        DATA_SM(ds302->_bootSlave[nodeid]).dcfLoadCount = 0;
+        DS302_DEBUG("ConciseDCF for %d: initialised OK with %d entries to load\n", nodeid, DATA_SM(ds302->_bootSlave[nodeid]).dcfCount);
+
+        // first try the whole concise DCF as one block download into the slave's own 0x1F22
+        // slaves without it refuse the transfer once, then get the entries one by one
+        UNS32   dcfLength = ds302_dcf_length (DATA_SM(ds302->_bootSlave[nodeid]).dcfData,
+            DATA_SM(ds302->_bootSlave[nodeid]).dcfSize);
+
+        if (!ds302->dcfNoBlock[nodeid] && dcfLength > 4) {
+            DATA_SM(ds302->_bootSlave[nodeid]).dcfState = 2;
+
+            UNS8 retcode = writeNetworkDictCallBackAI (d, nodeid,
+                0x1F22, nodeid,
+                dcfLength, domain,
+                DATA_SM(ds302->_bootSlave[nodeid]).dcfData,
+                _sm_BootSlave_downloadConfiguration,
+                0,  // the domain goes as is
+                1   // block mode
+                );
+
+            if (retcode == 0) {
+                DS302_DEBUG("ConciseDCF for %d: started block download of %d bytes\n", nodeid, dcfLength);
+                return;
+            }
+
+            // could not even start it, go entry by entry
+            DS302_DEBUG("ConciseDCF for %d: block download not started, loading entries\n", nodeid);
+            ds302->dcfNoBlock[nodeid] = 1;
+            DATA_SM(ds302->_bootSlave[nodeid]).dcfState = 0;
+        }
+    }
+
+    if (DATA_SM(ds302->_bootSlave[nodeid]).dcfState == 2) {
+        // result of the block download
+        UNS8    retcode = getWriteResultNetworkDict (d, nodeid, &DATA_SM(ds302->_bootSlave[nodeid]).errorCode);
+
+        if (retcode == SDO_UPLOAD_IN_PROGRESS || retcode == SDO_DOWNLOAD_IN_PROGRESS)
+            return;
+
+        closeSDOtransfer(d, nodeid, SDO_CLIENT);
+
+        if (retcode == SDO_FINISHED) {
+            // the slave took the whole DCF, nothing left to load
+            DATA_SM(ds302->_bootSlave[nodeid]).dcfLoadCount = DATA_SM(ds302->_bootSlave[nodeid]).dcfCount;
+        } else {
+            // no block download or no 0x1F22 on the slave, remember it and fall back to single entries
+            DS302_DEBUG("ConciseDCF for %d: block download refused (%x), loading entries\n", nodeid,
+                DATA_SM(ds302->_bootSlave[nodeid]).errorCode);
+            ds302->dcfNoBlock[nodeid] = 1;
+        }
+        DATA_SM(ds302->_bootSlave[nodeid]).dcfState = 0;
     }
 
     /* the main SDO write loop takes place HERE. Init write, wait complete, repeat for next */
     // loop while we still think we have data to load
-    while (DATA_SM(ds302_data._bootSlave[nodeid]).dcfCount > DATA_SM(ds302_data._bootSlave[nodeid]).dcfLoadCount) {
+    while (DATA_SM(ds302->_bootSlave[nodeid]).dcfCount > DATA_SM(ds302->_bootSlave[nodeid]).dcfLoadCount) {
         
-        if (DATA_SM(ds302_data._bootSlave[nodeid]).dcfState == 0) {
+        if (DATA_SM(ds302->_bootSlave[nodeid]).dcfState == 0) {
             
             UNS16   idx;
             UNS8    subidx;
@@ -688,34 +784,34 @@ void _sm_BootSlave_downloadConfiguration(CO_Data* d, UNS8 nodeid)
             
             // it's the start of a new data item
             int retcode = ds302_get_next_dcf (
-                DATA_SM(ds302_data._bootSlave[nodeid]).dcfData,
-                &DATA_SM(ds302_data._bootSlave[nodeid]).dcfCursor,
+                DATA_SM(ds302->_bootSlave[nodeid]).dcfData,
+                &DATA_SM(ds302->_bootSlave[nodeid]).dcfCursor,
                 &idx, &subidx, &size, &value);
                 
             if (retcode < 0) {
                 // error, bug off
 
                 DS302_DEBUG("ConciseDCF for %d: GOT DCF ERROR. Had %d, did %d\n", nodeid,
-                    DATA_SM(ds302_data._bootSlave[nodeid]).dcfCount,
-                    DATA_SM(ds302_data._bootSlave[nodeid]).dcfLoadCount);
+                    DATA_SM(ds302->_bootSlave[nodeid]).dcfCount,
+                    DATA_SM(ds302->_bootSlave[nodeid]).dcfLoadCount);
 
-                DATA_SM(ds302_data._bootSlave[nodeid]).result = SM_ErrJ;
-                STOP_SM(ds302_data._bootSlave[nodeid]);
+                DATA_SM(ds302->_bootSlave[nodeid]).result = SM_ErrJ;
+                STOP_SLAVE_SM(d, nodeid);
                 return;                
 
             } else if (retcode == 0) {
                 // EOS
                 // Odd, we hit EOS before the stated number of items
                 DS302_DEBUG("ConciseDCF for %d: apparently, we SHORT LOADED. Got EOS. Had %d, did %d\n", nodeid,
-                    DATA_SM(ds302_data._bootSlave[nodeid]).dcfCount,
-                    DATA_SM(ds302_data._bootSlave[nodeid]).dcfLoadCount);
-                DATA_SM(ds302_data._bootSlave[nodeid]).result = SM_ErrJ;
-                STOP_SM(ds302_data._bootSlave[nodeid]);
+                    DATA_SM(ds302->_bootSlave[nodeid]).dcfCount,
+                    DATA_SM(ds302->_bootSlave[nodeid]).dcfLoadCount);
+                DATA_SM(ds302->_bootSlave[nodeid]).result = SM_ErrJ;
+                STOP_SLAVE_SM(d, nodeid);
                 return;                
             }
             
             // at this point I have the data, so I can proceed
-            DATA_SM(ds302_data._bootSlave[nodeid]).dcfState = 1;
+            DATA_SM(ds302->_bootSlave[nodeid]).dcfState = 1;
             
             UNS8 retcode2 = writeNetworkDictCallBackAI (d, nodeid,
                 idx, subidx, 
@@ -728,11 +824,11 @@ void _sm_BootSlave_downloadConfiguration(CO_Data* d, UNS8 nodeid)
             if (retcode2 != 0) {
                 // hit a send error
                 DS302_DEBUG("ConciseDCF for %d: GOT DCF SDO SEND ERROR. Had %d, did %d\n", nodeid,
-                    DATA_SM(ds302_data._bootSlave[nodeid]).dcfCount,
-                    DATA_SM(ds302_data._bootSlave[nodeid]).dcfLoadCount);
+                    DATA_SM(ds302->_bootSlave[nodeid]).dcfCount,
+                    DATA_SM(ds302->_bootSlave[nodeid]).dcfLoadCount);
 
-                    DATA_SM(ds302_data._bootSlave[nodeid]).result = SM_ErrJ;
-                STOP_SM(ds302_data._bootSlave[nodeid]);
+                    DATA_SM(ds302->_bootSlave[nodeid]).result = SM_ErrJ;
+                STOP_SLAVE_SM(d, nodeid);
                 return;                                
             }
             
@@ -740,12 +836,12 @@ void _sm_BootSlave_downloadConfiguration(CO_Data* d, UNS8 nodeid)
             // we let the loop run, should end up on "else" and get a IN PROGRESS and return waiting for complete on callback
 
             DS302_DEBUG("ConciseDCF for %d: started load of next item. Did %d, have %d\n", nodeid,
-                DATA_SM(ds302_data._bootSlave[nodeid]).dcfLoadCount,
-                DATA_SM(ds302_data._bootSlave[nodeid]).dcfCount);
+                DATA_SM(ds302->_bootSlave[nodeid]).dcfLoadCount,
+                DATA_SM(ds302->_bootSlave[nodeid]).dcfCount);
             
         } else {
             // it's the continuation of a previous data item
-            UNS8    retcode = getWriteResultNetworkDict (d, nodeid, &DATA_SM(ds302_data._bootSlave[nodeid]).errorCode);
+            UNS8    retcode = getWriteResultNetworkDict (d, nodeid, &DATA_SM(ds302->_bootSlave[nodeid]).errorCode);
 
             if (retcode == SDO_UPLOAD_IN_PROGRESS || retcode == SDO_DOWNLOAD_IN_PROGRESS)
                 // do nothing, outside of callback call. Stupid
@@ -756,45 +852,120 @@ void _sm_BootSlave_downloadConfiguration(CO_Data* d, UNS8 nodeid)
 
             if(retcode != SDO_FINISHED) {
                 // we had an error situation, abort
-                DS302_DEBUG("ConciseDCF for %d: ABORT due to SDO error, %d/%x\n", nodeid, retcode, DATA_SM(ds302_data._bootSlave[nodeid]).errorCode);
-                DATA_SM(ds302_data._bootSlave[nodeid]).result = SM_ErrJ;
-                STOP_SM(ds302_data._bootSlave[nodeid]);
+                DS302_DEBUG("ConciseDCF for %d: ABORT due to SDO error, %d/%x\n", nodeid, retcode, DATA_SM(ds302->_bootSlave[nodeid]).errorCode);
+                DATA_SM(ds302->_bootSlave[nodeid]).result = SM_ErrJ;
+                STOP_SLAVE_SM(d, nodeid);
                 return;
             }
 
             // write completed ok, switch state to 0 and redo call
-            DATA_SM(ds302_data._bootSlave[nodeid]).dcfState = 0;
+            DATA_SM(ds302->_bootSlave[nodeid]).dcfState = 0;
             // also increment the load count
-            DATA_SM(ds302_data._bootSlave[nodeid]).dcfLoadCount++;
+            DATA_SM(ds302->_bootSlave[nodeid]).dcfLoadCount++;
 
             DS302_DEBUG("ConciseDCF for %d: completed load of item %d. Have %d\n", nodeid,
-                DATA_SM(ds302_data._bootSlave[nodeid]).dcfLoadCount,
-                DATA_SM(ds302_data._bootSlave[nodeid]).dcfCount);
+                DATA_SM(ds302->_bootSlave[nodeid]).dcfLoadCount,
+                DATA_SM(ds302->_bootSlave[nodeid]).dcfCount);
         }
     }
     
     DS302_DEBUG("ConciseDCF for %d: apparently, we loaded everything at this point. Had %d, did %d\n", nodeid,
-        DATA_SM(ds302_data._bootSlave[nodeid]).dcfCount,
-        DATA_SM(ds302_data._bootSlave[nodeid]).dcfLoadCount);
+        DATA_SM(ds302->_bootSlave[nodeid]).dcfCount,
+        DATA_SM(ds302->_bootSlave[nodeid]).dcfLoadCount);
     
     if (0) {
         // we had an error in the configuration download
         //SM_ERROR(nodeid, SM_ErrJ);
-        DATA_SM(ds302_data._bootSlave[nodeid]).result = SM_ErrJ;
-        STOP_SM(ds302_data._bootSlave[nodeid]);
+        DATA_SM(ds302->_bootSlave[nodeid]).result = SM_ErrJ;
+        STOP_SLAVE_SM(d, nodeid);
         return;
     } else {
-        // configuration downloaded OK, go to error control
-        //SM_SWITCH_STATE(SM_BOOTSLAVE_START_ERRCTL,d,nodeid)
-        SWITCH_SM (ds302_data._bootSlave[nodeid], SM_BOOTSLAVE_START_ERRCTL, d, nodeid);
+        // configuration downloaded OK, store the configuration version then go to error control
+        SWITCH_SM (ds302->_bootSlave[nodeid], SM_BOOTSLAVE_STORE_CONFVER, d, nodeid);
+        return;
+    }
+}
+
+void _sm_BootSlave_storeConfigurationVersion(CO_Data* d, UNS8 nodeid)
+{
+    ds302_t     *ds302 = ds302_ctx (d);
+    DS302_DEBUG("_sm_BootSlave_storeConfigurationVersion\n");
+    if (INITIAL_SM(ds302->_bootSlave[nodeid])) {
+        // code for the first run only
+        DATA_SM(ds302->_bootSlave[nodeid]).confStep = 0;
+
+        if (DATA_SM(ds302->_bootSlave[nodeid]).Expected1020_1 == 0 || DATA_SM(ds302->_bootSlave[nodeid]).Expected1020_2 == 0) {
+            // nothing to store, the slave gets the download every boot
+            SWITCH_SM (ds302->_bootSlave[nodeid], SM_BOOTSLAVE_START_ERRCTL, d, nodeid);
+            return;
+        }
+    } else {
+        // we end here on callback
+        UNS8    retcode = getWriteResultNetworkDict (d, nodeid, &DATA_SM(ds302->_bootSlave[nodeid]).errorCode);
+
+        if (retcode == SDO_UPLOAD_IN_PROGRESS || retcode == SDO_DOWNLOAD_IN_PROGRESS)
+            // do nothing, outside of callback call
+            return;
+
+        /* Finalise last SDO transfer with this node */
+        closeSDOtransfer(d, nodeid, SDO_CLIENT);
+
+        if (retcode != SDO_FINISHED) {
+            // not fatal, the configuration is in. The slave just gets the full download next boot
+            DS302_DEBUG("Slave %d did not store the configuration version (step %d, %x)\n", nodeid,
+                DATA_SM(ds302->_bootSlave[nodeid]).confStep, DATA_SM(ds302->_bootSlave[nodeid]).errorCode);
+            SWITCH_SM (ds302->_bootSlave[nodeid], SM_BOOTSLAVE_START_ERRCTL, d, nodeid);
+            return;
+        }
+
+        DATA_SM(ds302->_bootSlave[nodeid]).confStep++;
+    }
+
+    UNS16   idx;
+    UNS8    subidx;
+    UNS32   value;
+
+    switch (DATA_SM(ds302->_bootSlave[nodeid]).confStep) {
+        case 0:
+            // configuration date
+            idx = 0x1020; subidx = 0x01;
+            value = DATA_SM(ds302->_bootSlave[nodeid]).Expected1020_1;
+            break;
+        case 1:
+            // configuration time
+            idx = 0x1020; subidx = 0x02;
+            value = DATA_SM(ds302->_bootSlave[nodeid]).Expected1020_2;
+            break;
+        case 2:
+            // store all parameters ("save"), or 0x1020 is lost at the next reset
+            idx = 0x1010; subidx = 0x01;
+            value = 0x65766173;
+            break;
+        default:
+            DS302_DEBUG("Slave %d stored configuration version %08x/%08x\n", nodeid,
+                DATA_SM(ds302->_bootSlave[nodeid]).Expected1020_1, DATA_SM(ds302->_bootSlave[nodeid]).Expected1020_2);
+            SWITCH_SM (ds302->_bootSlave[nodeid], SM_BOOTSLAVE_START_ERRCTL, d, nodeid);
+            return;
+    }
+
+    UNS8 retcode = writeNetworkDictCallBackAI (d, nodeid,
+        idx, subidx,
+        sizeof (value), 0, &value,
+        _sm_BootSlave_storeConfigurationVersion,
+        0, 0);
+
+    if (retcode != 0) {
+        DS302_DEBUG("Slave %d: SDO send error storing the configuration version\n", nodeid);
+        SWITCH_SM (ds302->_bootSlave[nodeid], SM_BOOTSLAVE_START_ERRCTL, d, nodeid);
         return;
     }
 }
 
 void _sm_BootSlave_startErrorControlService(CO_Data* d, UNS8 nodeid)
 {
+    ds302_t     *ds302 = ds302_ctx (d);
     DS302_DEBUG("_sm_BootSlave_startErrorControlService\n");
-    if (INITIAL_SM(ds302_data._bootSlave[nodeid])) {      
+    if (INITIAL_SM(ds302->_bootSlave[nodeid])) {      
         // code for the first run only
     
         // display node state for fun
@@ -805,8 +976,8 @@ void _sm_BootSlave_startErrorControlService(CO_Data* d, UNS8 nodeid)
         UNS32   size;
         UNS8    dt = 0;
         size = sizeof (Obj1016);
-        DATA_SM(ds302_data._bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1016, nodeid, &Obj1016, &size, &dt, 0);
-        if (DATA_SM(ds302_data._bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
+        DATA_SM(ds302->_bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1016, nodeid, &Obj1016, &size, &dt, 0);
+        if (DATA_SM(ds302->_bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
             // null out the value, it means it's unavailable. It's not a fatal error
             Obj1016 = 0x00000000;
         }
@@ -819,7 +990,7 @@ void _sm_BootSlave_startErrorControlService(CO_Data* d, UNS8 nodeid)
             
             // non-zero consumer, use HB
             //SM_SWITCH_STATE(SM_BOOTSLAVE_WAIT_HB,d,nodeid)
-            SWITCH_SM (ds302_data._bootSlave[nodeid], SM_BOOTSLAVE_WAIT_HB, d, nodeid);
+            SWITCH_SM (ds302->_bootSlave[nodeid], SM_BOOTSLAVE_WAIT_HB, d, nodeid);
             return;
         } else {
             // zero consumer, use NodeGuard
@@ -830,8 +1001,8 @@ void _sm_BootSlave_startErrorControlService(CO_Data* d, UNS8 nodeid)
 
                 UNS32   Obj1F81;
                 size = sizeof (Obj1F81);
-                DATA_SM(ds302_data._bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F81, nodeid, &Obj1F81, &size, &dt, 0);
-                if (DATA_SM(ds302_data._bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
+                DATA_SM(ds302->_bootSlave[nodeid]).errorCode = readLocalDict (d, 0x1F81, nodeid, &Obj1F81, &size, &dt, 0);
+                if (DATA_SM(ds302->_bootSlave[nodeid]).errorCode != OD_SUCCESSFUL) {
                     // null out the value, it means it's unavailable. It's not a fatal error
                     Obj1F81 = 0x00000000;
                 }
@@ -843,20 +1014,20 @@ void _sm_BootSlave_startErrorControlService(CO_Data* d, UNS8 nodeid)
                     //node guard time non-zero
                     // start Node Guard for the node
                     //SM_SWITCH_STATE(SM_BOOTSLAVE_START_NODEGUARD,d,nodeid)
-                    SWITCH_SM (ds302_data._bootSlave[nodeid], SM_BOOTSLAVE_START_NODEGUARD, d, nodeid);
+                    SWITCH_SM (ds302->_bootSlave[nodeid], SM_BOOTSLAVE_START_NODEGUARD, d, nodeid);
                     return;
                 } else {
                     //node guard time zero
                     // go to error control started
                     //SM_SWITCH_STATE(SM_BOOTSLAVE_ERRCTL_STARTED,d,nodeid)
-                    SWITCH_SM (ds302_data._bootSlave[nodeid], SM_BOOTSLAVE_ERRCTL_STARTED, d, nodeid);
+                    SWITCH_SM (ds302->_bootSlave[nodeid], SM_BOOTSLAVE_ERRCTL_STARTED, d, nodeid);
                     return;
                 }
             } else {
                 // if no, error control completed OK
                 // go to error control started
                 //SM_SWITCH_STATE(SM_BOOTSLAVE_ERRCTL_STARTED,d,nodeid)
-                SWITCH_SM (ds302_data._bootSlave[nodeid], SM_BOOTSLAVE_ERRCTL_STARTED, d, nodeid);
+                SWITCH_SM (ds302->_bootSlave[nodeid], SM_BOOTSLAVE_ERRCTL_STARTED, d, nodeid);
                 return;
             }
         }
@@ -864,70 +1035,397 @@ void _sm_BootSlave_startErrorControlService(CO_Data* d, UNS8 nodeid)
 // nothing happens for subsequent runs, should not end here
 }
 
+/*
+    Heartbeat wait helpers. The fallback alarm handle is dropped as soon as it fires,
+    CanFestival may hand the slot to another alarm after that
+*/
+void _ds302_hb_wait_cancel (CO_Data* d, UNS8 nodeid)
+{
+    ds302_t     *ds302 = ds302_ctx (d);
+    if (DATA_SM(ds302->_bootSlave[nodeid]).hbTimer != TIMER_NONE) {
+        DelAlarm (DATA_SM(ds302->_bootSlave[nodeid]).hbTimer);
+        DATA_SM(ds302->_bootSlave[nodeid]).hbTimer = TIMER_NONE;
+    }
+}
+
+void _ds302_hb_wait_timeout (CO_Data* d, UNS32 id)
+{
+    ds302_t     *ds302 = ds302_ctx (d);
+    UNS8    nodeid = (UNS8)(id - 1024);
+
+    DATA_SM(ds302->_bootSlave[nodeid]).hbTimer = TIMER_NONE;
+    if (ds302->_bootSlave[nodeid].machine_state == SM_BOOTSLAVE_WAIT_HB)
+        RUN_SM(ds302->_bootSlave[nodeid], d, nodeid);
+}
+
 void _sm_BootSlave_waitHeartbeat(CO_Data* d, UNS8 nodeid)
-{    
+{
+    ds302_t     *ds302 = ds302_ctx (d);
     DS302_DEBUG("_sm_BootSlave_waitHeartbeat\n");
-    // dummy for now
-    if (INITIAL_SM(ds302_data._bootSlave[nodeid])) {
-        
+    if (INITIAL_SM(ds302->_bootSlave[nodeid])) {
+
         // register the start here. We are going to wait
-        DATA_SM(ds302_data._bootSlave[nodeid]).ecsStart = rtuClock();
-        
-        //SM_SWITCH_STATE(SM_BOOTSLAVE_ERRCTL_STARTED,d,nodeid)
-        //SWITCH_SM (ds302_data._bootSlave[nodeid], SM_BOOTSLAVE_ERRCTL_STARTED, d, nodeid);
-        //return;
+        DATA_SM(ds302->_bootSlave[nodeid]).ecsStart = rtuClock();
+        DATA_SM(ds302->_bootSlave[nodeid]).hbTimer = TIMER_NONE;
     }
-    
-    e_nodeState slavestate = getNodeState (d, nodeid);
+
+    e_nodeState slavestate = ds302_node_state (d, nodeid);
 
     if (slavestate == Operational || slavestate == Pre_operational || slavestate == Stopped) {
         // means we have a heartbeat here
         DS302_DEBUG("Node state for slave %d is %x. We have a heartbeat\n", nodeid, slavestate);
-        SWITCH_SM (ds302_data._bootSlave[nodeid], SM_BOOTSLAVE_ERRCTL_STARTED, d, nodeid);
+        _ds302_hb_wait_cancel (d, nodeid);
+        SWITCH_SM (ds302->_bootSlave[nodeid], SM_BOOTSLAVE_ERRCTL_STARTED, d, nodeid);
         return;
     }
-    
+
     // check if time elapsed
-    uint64_t    elapsedTime = rtuClock() - DATA_SM (ds302_data._bootSlave[nodeid]).ecsStart;
-    // need to update to the proper value
-    if (elapsedTime > 2*1000*1000) {
+    uint64_t    elapsedTime = rtuClock() - DATA_SM (ds302->_bootSlave[nodeid]).ecsStart;
+    if (elapsedTime >= NODE_HB_WAIT_TIME) {
         // allow for the HB time to see a change
-        
+
         DS302_DEBUG("HB wait time for %d elapsed (%d), we have a problem\n", nodeid, elapsedTime);
-        DATA_SM(ds302_data._bootSlave[nodeid]).result = SM_ErrK;
-        STOP_SM(ds302_data._bootSlave[nodeid]);
-        return;        
+        _ds302_hb_wait_cancel (d, nodeid);
+        DATA_SM(ds302->_bootSlave[nodeid]).result = SM_ErrK;
+        STOP_SLAVE_SM(d, nodeid);
+        return;
     }
-    
-    // register the alarm for this one for 100ms
+
+    // the first heartbeat frame runs us again (_onSlaveStateChange), the alarm is only the timeout
     // is this an ugly hack or what? Looks like we have an ID collision
-    SetAlarm (d, nodeid + 1024, (TimerCallback_t)_sm_BootSlave_waitHeartbeat, MS_TO_TIMEVAL(100), 0);
+    if (DATA_SM(ds302->_bootSlave[nodeid]).hbTimer == TIMER_NONE)
+        DATA_SM(ds302->_bootSlave[nodeid]).hbTimer = SetAlarm (d, nodeid + 1024, _ds302_hb_wait_timeout,
+            US_TO_TIMEVAL(NODE_HB_WAIT_TIME - elapsedTime), 0);
+}
+
+/*
+    Node guarding timer wheel
+    A node due in n ticks goes in slot (cursor + n), with the full turns it has to wait in rounds
+*/
+static void _ds302_ng_insert (CO_Data* d, UNS8 nodeid, UNS32 ms)
+{
+    ds302_t     *ds302 = ds302_ctx (d);
+    ds302_guard_wheel_t *   wheel = &ds302->guard;
+    UNS32                   ticks = (ms + DS302_NG_TICK_MS - 1) / DS302_NG_TICK_MS;
+    UNS32                   slot;
+
+    if (ticks == 0)
+        ticks = 1;
+    slot = (wheel->cursor + ticks) & (DS302_NG_WHEEL_SLOTS - 1);
+
+    wheel->node[nodeid].rounds = (ticks - 1) / DS302_NG_WHEEL_SLOTS;
+    wheel->node[nodeid].next = wheel->slot[slot];
+    wheel->node[nodeid].linked = 1;
+    wheel->slot[slot] = nodeid;
+}
+
+/*
+    A node is due: check the answer to the previous request and send the next one
+    The answer is seen through the NMT table. It is set to Unknown_state with the request
+    and CanFestival stores the state from the answer (ds302_node_state hides the gap)
+*/
+static void _ds302_ng_guard (CO_Data* d, UNS8 nodeid)
+{
+    ds302_t     *ds302 = ds302_ctx (d);
+    ds302_guard_t *     guard = &ds302->guard.node[nodeid];
+
+    if (guard->pending && d->NMTable[nodeid] == Unknown_state) {
+        // no answer within a guard time
+        if (guard->missed < 0xFF)
+            guard->missed++;
+        if (guard->missed >= guard->retryFactor && !guard->lost) {
+            // life time elapsed, the node is gone
+            EPOS_WARN ("node guarding: no answer from CAN ID %02x in %d ms\n", nodeid, guard->guardTime * guard->retryFactor);
+            guard->lost = 1;
+            guard->lastState = Disconnected;
+            d->NMTable[nodeid] = Disconnected;
+            if (d->post_SlaveStateChange)
+                (*d->post_SlaveStateChange)(d, nodeid, Disconnected);
+        }
+    } else if (guard->pending) {
+        // answered
+        guard->missed = 0;
+        guard->lost = 0;
+        guard->lastState = d->NMTable[nodeid];
+    }
+
+    // lastState is what ds302_node_state reports until the answer comes in
+    __sync_synchronize();
+    d->NMTable[nodeid] = Unknown_state;
+    guard->pending = 1;
+    masterRequestNodeState (d, nodeid);
+}
+
+/*
+    The statistics are written by the CAN threads (under the CanFestival lock) and read lock free
+    by update(). 64 bit fields can tear on 32 bit targets, so the writes go in a sequence lock
+*/
+static void _ds302_hb_write (ds302_hbstat_t *hb)
+{
+    hb->seq++;
+    __sync_synchronize();
+}
+
+static void _ds302_hb_written (ds302_hbstat_t *hb)
+{
+    __sync_synchronize();
+    hb->seq++;
+}
+
+/*
+    Heartbeat consumer statistics: on each tick the nodes that sent a heartbeat since the previous one
+    are set to Unknown_state again, so the next frame comes through the slave state change callback
+*/
+static void _ds302_hb_arm (CO_Data* d)
+{
+    ds302_t     *ds302 = ds302_ctx (d);
+    int     nodeid;
+
+    DS302_NL_FOREACH (ds302->hbmap, nodeid) {
+        ds302_hbstat_t *    hb = &ds302->hb[nodeid];
+        e_nodeState         state = d->NMTable[nodeid];
+
+        if (hb->reset) {
+            _ds302_hb_write (hb);
+            hb->min = 0;
+            hb->max = 0;
+            hb->sum = 0;
+            hb->count = 0;
+            hb->misses = 0;
+            _ds302_hb_written (hb);
+            hb->reset = 0;
+        }
+
+        // still waiting, or the node is guarded and the guard requests own the table
+        if (hb->armed || ds302->guard.node[nodeid].active)
+            continue;
+        // lost or booting nodes report their own state changes
+        if (state != Operational && state != Pre_operational && state != Stopped)
+            continue;
+
+        // lastState is what ds302_node_state reports until the frame comes in. The flag goes
+        // up before the table changes, so ds302_node_state (lock free) never sees one without the other
+        hb->lastState = state;
+        hb->armed = 1;
+        __sync_synchronize();
+        d->NMTable[nodeid] = Unknown_state;
+    }
+}
+
+/* records a heartbeat frame */
+static void _ds302_hb_arrival (CO_Data* d, UNS8 nodeid, e_nodeState state)
+{
+    ds302_t     *ds302 = ds302_ctx (d);
+    ds302_hbstat_t *    hb = &ds302->hb[nodeid];
+    uint64_t            now = rtuClock();
+
+    // CanFestival stores the state only after the callback. Store it before disarming, so
+    // ds302_node_state (lock free, from update()) never sees Unknown_state without the flag
+    d->NMTable[nodeid] = state;
+    __sync_synchronize();
+    hb->armed = 0;
+
+    _ds302_hb_write (hb);
+
+    if (state == Initialisation) {
+        // bootup, the producer time is set again by the slave boot
+        hb->last = 0;
+        _ds302_hb_written (hb);
+        return;
+    }
+
+    if (hb->last != 0) {
+        UNS32   interval = (UNS32)(now - hb->last);
+
+        if (hb->count == 0 || interval < hb->min)
+            hb->min = interval;
+        if (interval > hb->max)
+            hb->max = interval;
+        hb->sum += interval;
+        hb->count++;
+    }
+    hb->last = now;
+    _ds302_hb_written (hb);
+}
+
+/* the wheel alarm, one slot per tick */
+static void _ds302_ng_tick (CO_Data* d, UNS32 id)
+{
+    ds302_t     *ds302 = ds302_ctx (d);
+    ds302_guard_wheel_t *   wheel = &ds302->guard;
+    UNS8                    nodeid, next;
+
+    wheel->cursor = (wheel->cursor + 1) & (DS302_NG_WHEEL_SLOTS - 1);
+
+    // take the slot list, the nodes not due yet go back in the same slot
+    nodeid = wheel->slot[wheel->cursor];
+    wheel->slot[wheel->cursor] = 0;
+
+    for (; nodeid != 0; nodeid = next) {
+        ds302_guard_t *     guard = &wheel->node[nodeid];
+
+        next = guard->next;
+        guard->linked = 0;
+
+        if (!guard->active)
+            continue;
+
+        if (guard->rounds > 0) {
+            guard->rounds--;
+            guard->next = wheel->slot[wheel->cursor];
+            guard->linked = 1;
+            wheel->slot[wheel->cursor] = nodeid;
+            continue;
+        }
+
+        _ds302_ng_guard (d, nodeid);
+        _ds302_ng_insert (d, nodeid, guard->guardTime);
+    }
+
+    _ds302_hb_arm (d);
+}
+
+/* starts the wheel alarm, shared by the node guarding and the heartbeat statistics */
+static void _ds302_ng_timer (CO_Data* d)
+{
+    ds302_t     *ds302 = ds302_ctx (d);
+    if (ds302->guard.timer == TIMER_NONE)
+        ds302->guard.timer = SetAlarm (d, 0x4E47, _ds302_ng_tick, MS_TO_TIMEVAL(DS302_NG_TICK_MS), MS_TO_TIMEVAL(DS302_NG_TICK_MS));
+}
+
+void ds302_ng_start (CO_Data* d, UNS8 nodeid, UNS16 guardTime, UNS8 retryFactor)
+{
+    ds302_t     *ds302 = ds302_ctx (d);
+    ds302_guard_t *     guard;
+
+    if (nodeid < 1 || nodeid >= NMT_MAX_NODE_ID || guardTime == 0)
+        return;
+
+    guard = &ds302->guard.node[nodeid];
+    guard->guardTime = guardTime;
+    guard->retryFactor = retryFactor ? retryFactor : 1;
+    guard->missed = 0;
+    guard->lost = 0;
+    guard->pending = 0;
+    guard->lastState = d->NMTable[nodeid];
+    guard->active = 1;
+
+    // a node stopped and restarted before its slot came up is still in the wheel
+    if (!guard->linked)
+        _ds302_ng_insert (d, nodeid, guardTime);
+
+    _ds302_ng_timer (d);
+
+    DS302_DEBUG ("node guarding for %d started, %d ms x %d\n", nodeid, guardTime, guard->retryFactor);
+}
+
+void ds302_ng_stop (CO_Data* d, UNS8 nodeid)
+{
+    ds302_t     *ds302 = ds302_ctx (d);
+    if (nodeid < 1 || nodeid >= NMT_MAX_NODE_ID || !ds302->guard.node[nodeid].active)
+        return;
+
+    // unlinked from its slot on the next pass
+    ds302->guard.node[nodeid].active = 0;
+    if (ds302->guard.node[nodeid].pending && d->NMTable[nodeid] == Unknown_state)
+        d->NMTable[nodeid] = ds302->guard.node[nodeid].lastState;
+    ds302->guard.node[nodeid].pending = 0;
+}
+
+e_nodeState ds302_node_state (CO_Data* d, UNS8 nodeid)
+{
+    ds302_t     *ds302 = ds302_ctx (d);
+    e_nodeState     state = getNodeState (d, nodeid);
+
+    if (state == Unknown_state && nodeid > 0 && nodeid < NMT_MAX_NODE_ID && ds302->guard.node[nodeid].active)
+        return ds302->guard.node[nodeid].lastState;
+    if (state == Unknown_state && nodeid > 0 && nodeid < NMT_MAX_NODE_ID && ds302->hb[nodeid].armed)
+        return ds302->hb[nodeid].lastState;
+    // a heartbeat came in between the two reads, the table holds its state by now
+    if (state == Unknown_state && nodeid > 0 && nodeid < NMT_MAX_NODE_ID && ds302->hb[nodeid].active) {
+        __sync_synchronize();
+        state = getNodeState (d, nodeid);
+    }
+
+    return state;
 }
 
 void _sm_BootSlave_startNodeGuard(CO_Data* d, UNS8 nodeid)
 {
+    ds302_t     *ds302 = ds302_ctx (d);
     DS302_DEBUG("_sm_BootSlave_startNodeGuard\n");
-    // dummy for now
-    if (INITIAL_SM(ds302_data._bootSlave[nodeid])) {
-        //SM_SWITCH_STATE(SM_BOOTSLAVE_ERRCTL_STARTED,d,nodeid)
-        SWITCH_SM (ds302_data._bootSlave[nodeid], SM_BOOTSLAVE_ERRCTL_STARTED, d, nodeid);
+
+    UNS32   Obj1F81 = ds302_nl(d)->entry[nodeid];
+
+    if (INITIAL_SM(ds302->_bootSlave[nodeid])) {
+        // code for the first run only
+        // set the slave side (life guarding) to the same guard time and factor
+        DATA_SM(ds302->_bootSlave[nodeid]).confStep = 0;
+    } else {
+        // we end here on callback
+        UNS8    retcode = getWriteResultNetworkDict (d, nodeid, &DATA_SM(ds302->_bootSlave[nodeid]).errorCode);
+
+        if (retcode == SDO_UPLOAD_IN_PROGRESS || retcode == SDO_DOWNLOAD_IN_PROGRESS)
+            // do nothing, outside of callback call
+            return;
+
+        /* Finalise last SDO transfer with this node */
+        closeSDOtransfer(d, nodeid, SDO_CLIENT);
+
+        if (retcode != SDO_FINISHED) {
+            // not fatal, the guard time may come from the DCF or the slave defaults
+            DS302_DEBUG("Slave %d did not take the life guarding setting (step %d, %x)\n", nodeid,
+                DATA_SM(ds302->_bootSlave[nodeid]).confStep, DATA_SM(ds302->_bootSlave[nodeid]).errorCode);
+        }
+
+        DATA_SM(ds302->_bootSlave[nodeid]).confStep++;
+    }
+
+    UNS8    retcode = 0;
+    UNS16   guardTime = DS302_NL_GUARD_TIME(Obj1F81);
+    UNS8    retryFactor = DS302_NL_RETRY_FACTOR(Obj1F81);
+
+    switch (DATA_SM(ds302->_bootSlave[nodeid]).confStep) {
+        case 0:
+            // guard time
+            retcode = writeNetworkDictCallBackAI (d, nodeid, 0x100C, 0x00, sizeof (guardTime), 0, &guardTime,
+                _sm_BootSlave_startNodeGuard, 0, 0);
+            break;
+        case 1:
+            // life time factor
+            retcode = writeNetworkDictCallBackAI (d, nodeid, 0x100D, 0x00, sizeof (retryFactor), 0, &retryFactor,
+                _sm_BootSlave_startNodeGuard, 0, 0);
+            break;
+        default:
+            // the slave is set, start guarding it from our side
+            ds302_ng_start (d, nodeid, guardTime, retryFactor);
+            SWITCH_SM (ds302->_bootSlave[nodeid], SM_BOOTSLAVE_ERRCTL_STARTED, d, nodeid);
+            return;
+    }
+
+    if (retcode != 0) {
+        // SDO send error, guard anyway
+        DS302_DEBUG("Slave %d: SDO send error setting up life guarding\n", nodeid);
+        ds302_ng_start (d, nodeid, guardTime, retryFactor);
+        SWITCH_SM (ds302->_bootSlave[nodeid], SM_BOOTSLAVE_ERRCTL_STARTED, d, nodeid);
         return;
     }
 }
 
 void _sm_BootSlave_errorControlStarted(CO_Data* d, UNS8 nodeid)  // here we need to check if we went D/noconfig and exit
 {
+    ds302_t     *ds302 = ds302_ctx (d);
     DS302_DEBUG("_sm_BootSlave_errorControlStarted\n");
-    if (INITIAL_SM(ds302_data._bootSlave[nodeid])) {
+    if (INITIAL_SM(ds302->_bootSlave[nodeid])) {
         // simple decisional node, have we went via D path or not
-        if (DATA_SM(ds302_data._bootSlave[nodeid]).ViaDPath) {
+        if (DATA_SM(ds302->_bootSlave[nodeid]).ViaDPath) {
             //SM_ERROR(nodeid, SM_ErrL);
-            DATA_SM(ds302_data._bootSlave[nodeid]).result = SM_ErrL;
-            STOP_SM(ds302_data._bootSlave[nodeid]);
+            DATA_SM(ds302->_bootSlave[nodeid]).result = SM_ErrL;
+            STOP_SLAVE_SM(d, nodeid);
             return;
         } else {
             //SM_SWITCH_STATE(SM_BOOTSLAVE_START_SLAVE,d,nodeid)
-            SWITCH_SM (ds302_data._bootSlave[nodeid], SM_BOOTSLAVE_START_SLAVE, d, nodeid);
+            SWITCH_SM (ds302->_bootSlave[nodeid], SM_BOOTSLAVE_START_SLAVE, d, nodeid);
             return;
         }
     }
@@ -935,8 +1433,9 @@ void _sm_BootSlave_errorControlStarted(CO_Data* d, UNS8 nodeid)  // here we need
 
 void _sm_BootSlave_startSlave(CO_Data* d, UNS8 nodeid)
 {
+    ds302_t     *ds302 = ds302_ctx (d);
     DS302_DEBUG("_sm_BootSlave_startSlave\n");
-    if (INITIAL_SM(ds302_data._bootSlave[nodeid])) {
+    if (INITIAL_SM(ds302->_bootSlave[nodeid])) {
         
         // am I allowed to start the nodes? 0x1F80 bit 3
         if (ds302_bitcheck_32(d, 0x1F80, 0x00, DS302_DEVICE_MANUAL_START_SLAVE) == 0) {
@@ -951,8 +1450,8 @@ void _sm_BootSlave_startSlave(CO_Data* d, UNS8 nodeid)
 
                 // we're done here
                 //SM_ERROR(nodeid, SM_OK);
-                DATA_SM(ds302_data._bootSlave[nodeid]).result = SM_OK;
-                STOP_SM(ds302_data._bootSlave[nodeid]);
+                DATA_SM(ds302->_bootSlave[nodeid]).result = SM_OK;
+                STOP_SLAVE_SM(d, nodeid);
                 return;
             } else {
                 // no I don't
@@ -966,14 +1465,14 @@ void _sm_BootSlave_startSlave(CO_Data* d, UNS8 nodeid)
         
                     // we're done here
                     //SM_ERROR(nodeid, SM_OK);
-                    DATA_SM(ds302_data._bootSlave[nodeid]).result = SM_OK;
-                    STOP_SM(ds302_data._bootSlave[nodeid]);
+                    DATA_SM(ds302->_bootSlave[nodeid]).result = SM_OK;
+                    STOP_SLAVE_SM(d, nodeid);
                     return;
                 } else {
                     // nope, we're done here
                     //SM_ERROR(nodeid, SM_OK);
-                    DATA_SM(ds302_data._bootSlave[nodeid]).result = SM_OK;
-                    STOP_SM(ds302_data._bootSlave[nodeid]);
+                    DATA_SM(ds302->_bootSlave[nodeid]).result = SM_OK;
+                    STOP_SLAVE_SM(d, nodeid);
                     return;
                 }
             }
@@ -981,8 +1480,8 @@ void _sm_BootSlave_startSlave(CO_Data* d, UNS8 nodeid)
             // nope
             // we're done here
             //SM_ERROR(nodeid, SM_OK);
-            DATA_SM(ds302_data._bootSlave[nodeid]).result = SM_OK;
-            STOP_SM(ds302_data._bootSlave[nodeid]);
+            DATA_SM(ds302->_bootSlave[nodeid]).result = SM_OK;
+            STOP_SLAVE_SM(d, nodeid);
             return;
         }
     } else {
@@ -998,6 +1497,79 @@ void _sm_BootSlave_startSlave(CO_Data* d, UNS8 nodeid)
   Helper functions
 */
 
+/*
+    Network list cache
+    0x1F80/0x1F81 are looked at on every boot step and for every node, keep them as bitmaps
+*/
+#define NL_SET(map, nodeid)     (map)[(nodeid) >> 5] |= (1U << ((nodeid) & 31))
+#define NL_TEST(map, nodeid)    (((map)[(nodeid) >> 5] >> ((nodeid) & 31)) & 1)
+#define NL_CLR(map, nodeid)     (map)[(nodeid) >> 5] &= ~(1U << ((nodeid) & 31))
+
+static void _ds302_nl_build (CO_Data* d)
+{
+    ds302_t     *ds302 = ds302_ctx (d);
+    const indextable *      ODindex;
+    UNS32                   errorCode;
+    int                     nodeid;
+
+    memset (&ds302->nl, 0, sizeof (ds302->nl));
+
+    ODindex = (*d->scanIndexOD)(d, 0x1F80, &errorCode);
+    if (errorCode == OD_SUCCESSFUL)
+        ds302->nl.device = *(UNS32 *)ODindex->pSubindex[0].pObject;
+
+    ODindex = (*d->scanIndexOD)(d, 0x1F81, &errorCode);
+    if (errorCode == OD_SUCCESSFUL) {
+        for (nodeid = 1; nodeid < ODindex->bSubCount && nodeid < NMT_MAX_NODE_ID; nodeid++) {
+            UNS32   entry = *(UNS32 *)ODindex->pSubindex[nodeid].pObject;
+
+            ds302->nl.entry[nodeid] = entry;
+            if (!(entry & DS302_NL_IS_SLAVE))
+                continue;
+
+            NL_SET (ds302->nl.slave, nodeid);
+            if (entry & DS302_NL_MANDATORY)
+                NL_SET (ds302->nl.mandatory, nodeid);
+            if (entry & DS302_NL_DONOT_RESET)
+                NL_SET (ds302->nl.keepalive, nodeid);
+            if (entry & DS302_NL_ONBOOT_START_SLAVE)
+                NL_SET (ds302->nl.autostart, nodeid);
+        }
+    }
+
+    ds302->nl.valid = 1;
+}
+
+const ds302_nl_cache_t *ds302_nl (CO_Data* d)
+{
+    ds302_t     *ds302 = ds302_ctx (d);
+    if (!ds302->nl.valid)
+        _ds302_nl_build (d);
+    return &ds302->nl;
+}
+
+/* any write to 0x1F80/0x1F81 drops the cache */
+static UNS32 _ds302_nl_changed (CO_Data* d, const indextable *idx, UNS8 bSubindex)
+{
+    ds302_t     *ds302 = ds302_ctx (d);
+    ds302->nl.valid = 0;
+    return OD_SUCCESSFUL;
+}
+
+int ds302_nl_next (const UNS32 *map, int nodeid)
+{
+    while (nodeid < NMT_MAX_NODE_ID) {
+        UNS32   word = map[nodeid >> 5] >> (nodeid & 31);
+
+        if (word)
+            return nodeid + __builtin_ctz (word);
+        // nothing left in this word, go to the start of the next one
+        nodeid = (nodeid | 31) + 1;
+    }
+
+    return NMT_MAX_NODE_ID;
+}
+
 /*
   General bit checking for OD
   in: index, subindex, bitmask
@@ -1008,6 +1580,12 @@ int	ds302_bitcheck_32 (CO_Data* d, UNS16 idx, UNS8 subidx, UNS32 bitmask)
     const indextable *      ODindex;
     UNS32                   errorCode;
 
+    // the network list objects come from the cache
+    if (idx == 0x1F80 && subidx == 0)
+        return (ds302_nl(d)->device & bitmask) == bitmask;
+    if (idx == 0x1F81 && subidx > 0 && subidx < NMT_MAX_NODE_ID)
+        return (ds302_nl(d)->entry[subidx] & bitmask) == bitmask;
+
     ODindex = (*d->scanIndexOD)(d, idx, &errorCode);
     if (errorCode != OD_SUCCESSFUL)
         return -1;
@@ -1022,44 +1600,22 @@ int	ds302_bitcheck_32 (CO_Data* d, UNS16 idx, UNS8 subidx, UNS32 bitmask)
 int	ds302_nl_keepalive_nodes_present(CO_Data* d)
 {
     DS302_DEBUG("ds302_nl_keepalive_nodes_present\n");
-    const indextable *	Object1F81;
-    UNS32		errorCode;
-
-    Object1F81 = (*d->scanIndexOD)(d, 0x1F81, &errorCode);
-    if (errorCode != OD_SUCCESSFUL)
-        return -1;
 
-    // check all the objects for the presence of keepalive
-    int	nodeid;
-    for (nodeid = 1; nodeid < Object1F81->bSubCount; nodeid++) {
-        if ((*(UNS32 *)Object1F81->pSubindex[nodeid].pObject & DS302_NL_DONOT_RESET) && (*(UNS32 *)Object1F81->pSubindex[nodeid].pObject & DS302_NL_IS_SLAVE))
-            return 1;
-    }
-
-    return 0;
+    return ds302_nl_next (ds302_nl(d)->keepalive, 1) < NMT_MAX_NODE_ID;
 }
 
 int	ds302_nl_send_reset_to_non_keepalive(CO_Data* d)
 {
-    const indextable *      Object1F81;
-    UNS32           	errorCode;
-
-    Object1F81 = (*d->scanIndexOD)(d, 0x1F81, &errorCode);
-    if (errorCode != OD_SUCCESSFUL)
-            return 0;
-
-    // check all the objects for the presence of keepalive
-    int     nodeid;
-    for (nodeid = 1; nodeid < Object1F81->bSubCount; nodeid++) {
-        if (*(UNS32 *)Object1F81->pSubindex[nodeid].pObject & DS302_NL_IS_SLAVE) {
-            // node is in list
-            if ((*(UNS32 *)Object1F81->pSubindex[nodeid].pObject & DS302_NL_DONOT_RESET) == 0) {
-                // node does not have keepalive set, send reset comm
-                DS302_DEBUG ("Send reset to node id %d\n", nodeid);
-                masterSendNMTstateChange (d, nodeid, NMT_Reset_Comunication);
-            } else {
-                DS302_DEBUG ("DO NOT send reset to node id %d, has KEEPALIVE set\n", nodeid);
-            }
+    const ds302_nl_cache_t *nl = ds302_nl(d);
+    int                     nodeid;
+
+    DS302_NL_FOREACH (nl->slave, nodeid) {
+        if (!NL_TEST (nl->keepalive, nodeid)) {
+            // node does not have keepalive set, send reset comm
+            DS302_DEBUG ("Send reset to node id %d\n", nodeid);
+            masterSendNMTstateChange (d, nodeid, NMT_Reset_Comunication);
+        } else {
+            DS302_DEBUG ("DO NOT send reset to node id %d, has KEEPALIVE set\n", nodeid);
         }
     }
 
@@ -1072,20 +1628,10 @@ int	ds302_nl_send_reset_to_non_keepalive(CO_Data* d)
 */
 int	ds302_nl_node_in_list(CO_Data* d, UNS8 nodeid)
 {
-    const indextable *      Object1F81;
-    UNS32           errorCode;
+    if (nodeid > 0 && nodeid < NMT_MAX_NODE_ID)
+        return NL_TEST (ds302_nl(d)->slave, nodeid);
 
-    Object1F81 = (*d->scanIndexOD)(d, 0x1F81, &errorCode);
-    if (errorCode != OD_SUCCESSFUL)
-        return 0;
-
-    if (nodeid < Object1F81->bSubCount && nodeid > 0) {
-
-        return (*(UNS32 *)Object1F81->pSubindex[nodeid].pObject & DS302_NL_IS_SLAVE) != 0;
-    } else {
-
-        return 0;
-    }
+    return 0;
 }
 
 /*
@@ -1094,55 +1640,76 @@ int	ds302_nl_node_in_list(CO_Data* d, UNS8 nodeid)
 
 int     ds302_nl_mandatory_node(CO_Data* d, UNS8 nodeid)
 {
-    const indextable *      Object1F81;
-    UNS32           errorCode;
-
-    Object1F81 = (*d->scanIndexOD)(d, 0x1F81, &errorCode);
-    if (errorCode != OD_SUCCESSFUL)
-        return -1;
-
-    if (nodeid < Object1F81->bSubCount && nodeid > 0) {
-
-        return ((*(UNS32 *)Object1F81->pSubindex[nodeid].pObject & DS302_NL_IS_SLAVE) != 0) && ((*(UNS32 *)Object1F81->pSubindex[nodeid].pObject & DS302_NL_MANDATORY) != 0);
-    } else {
+    if (nodeid > 0 && nodeid < NMT_MAX_NODE_ID)
+        return NL_TEST (ds302_nl(d)->mandatory, nodeid);
 
-        return 0;
-    }
+    return 0;
 }
 
 int ds302_all_mandatory_booted (CO_Data* d)
 {
-    const indextable *      Object1F81;
-    UNS32                   errorCode;
-
-    Object1F81 = (*d->scanIndexOD)(d, 0x1F81, &errorCode);
-    if (errorCode != OD_SUCCESSFUL)
-        return -1;
+    ds302_t     *ds302 = ds302_ctx (d);
+    int     nodeid;
 
-    // check all the objects for the boot status if mandatory slaves
-    int     nodeid;  
-    for (nodeid = 1; nodeid < Object1F81->bSubCount; nodeid++) {
-        if (*(UNS32 *)Object1F81->pSubindex[nodeid].pObject & DS302_NL_IS_SLAVE) {
-            // node is in list
-            if (*(UNS32 *)Object1F81->pSubindex[nodeid].pObject & DS302_NL_MANDATORY) {
-                // node is mandatory
-                if (DATA_SM(ds302_data._bootSlave[nodeid]).state != BootCompleted) {
-                    DS302_DEBUG ("Mandatory slave not booted\n");
-                    DS302_DEBUG ("Slave ID is %d, state is %d\n", nodeid, DATA_SM(ds302_data._bootSlave[nodeid]).state);
-                    return 0;
-                }
-            }
+    // check the boot status of the mandatory slaves only
+    DS302_NL_FOREACH (ds302_nl(d)->mandatory, nodeid) {
+        if (DATA_SM(ds302->_bootSlave[nodeid]).state != BootCompleted) {
+            DS302_DEBUG ("Mandatory slave not booted\n");
+            DS302_DEBUG ("Slave ID is %d, state is %d\n", nodeid, DATA_SM(ds302->_bootSlave[nodeid]).state);
+            return 0;
         }
     }
 
     return 1;
 }
 
+/*
+    Master boot machine wakeup. A single alarm is kept pending, a wakeup replaces the fallback poll
+*/
+void _ds302_master_tick (CO_Data* d, UNS32 idx)
+{
+    ds302_t     *ds302 = ds302_ctx (d);
+    // the alarm is free once fired, forget the handle
+    ds302->masterTimer = TIMER_NONE;
+    RUN_SM(ds302->_masterBoot, d, idx);
+}
+
+void _ds302_master_alarm (CO_Data* d, UNS32 idx, UNS32 ms)
+{
+    ds302_t     *ds302 = ds302_ctx (d);
+    if (ds302->masterTimer != TIMER_NONE)
+        DelAlarm (ds302->masterTimer);
+    ds302->masterTimer = SetAlarm (d, idx, _ds302_master_tick, MS_TO_TIMEVAL(ms), 0);
+}
+
+/*
+    Runs the master boot machine on the next timer dispatch, if it is waiting on slaves or operational
+*/
+void ds302_notify_master (CO_Data* d)
+{
+    ds302_t     *ds302 = ds302_ctx (d);
+    if (!RUNNING_SM(ds302->_masterBoot))
+        return;
+    if (ds302->_masterBoot.machine_state != MB_BOOTPROC && ds302->_masterBoot.machine_state != MB_OPERWAIT)
+        return;
+    _ds302_master_alarm (d, NMT_MAX_NODE_ID, 0);
+}
+
+/*
+    Called when a slave boot machine stops
+*/
+void _ds302_slave_done (CO_Data* d, UNS8 nodeid)
+{
+    DS302_DEBUG("Slave boot %d stopped, notify master\n", nodeid);
+    ds302_notify_master (d);
+}
+
 void _sm_BootMaster_initial (CO_Data* d, UNS32 idx)
 {
+    ds302_t     *ds302 = ds302_ctx (d);
     DS302_DEBUG ("_sm_BootMaster_initial ENTRY\n");
 
-    if (INITIAL_SM(ds302_data._masterBoot)) {
+    if (INITIAL_SM(ds302->_masterBoot)) {
 
         // no longer doing data init
         /* initialize data structures */
@@ -1160,7 +1727,7 @@ void _sm_BootMaster_initial (CO_Data* d, UNS32 idx)
             // enter slave state
             DS302_DEBUG("I am not a master, so not booting\n");
             // not needed, stop the boot machine
-            STOP_SM(ds302_data._masterBoot);
+            STOP_SM(ds302->_masterBoot);
             return;
         }
 
@@ -1180,11 +1747,12 @@ void _sm_BootMaster_initial (CO_Data* d, UNS32 idx)
     }
 
     // go straight to the boot process, always
-    SWITCH_SM(ds302_data._masterBoot, MB_BOOTPROC, d, idx);
+    SWITCH_SM(ds302->_masterBoot, MB_BOOTPROC, d, idx);
 }
 
 void _sm_BootMaster_bootproc (CO_Data* d, UNS32 idx)
 {
+    ds302_t     *ds302 = ds302_ctx (d);
     int	slaveid;
 
     DS302_DEBUG ("_sm_BootMaster_bootproc ENTRY (%d)\n", idx);
@@ -1195,36 +1763,30 @@ void _sm_BootMaster_bootproc (CO_Data* d, UNS32 idx)
     // verify if we are done here
     if (ds302_all_mandatory_booted(d)) {
         // switch to the next step
-        SWITCH_SM(ds302_data._masterBoot, MB_OPERWAIT, d, idx);
+        SWITCH_SM(ds302->_masterBoot, MB_OPERWAIT, d, idx);
         return;
     }
 
     // if we are not yet done, process the state machines
-    if (INITIAL_SM(ds302_data._masterBoot)) {
+    if (INITIAL_SM(ds302->_masterBoot)) {
 
         // this is the first run, so start all the state machines for the slaves in the network list
         DS302_DEBUG ("_sm_BootMaster_bootproc INITIAL\n");
 
-        for (slaveid=1; slaveid<NMT_MAX_NODE_ID; slaveid++)
-            if (ds302_nl_node_in_list(d, slaveid)) {
-                // it's a slave, so start it's machine
-                
-                // mark the machine as used
-                DATA_SM (ds302_data._bootSlave[slaveid]).state = BootInitialised;
-                
-                // mark the start time
-                //SM_DATA(i,start_time) = rtuClock();
-                DATA_SM(ds302_data._bootSlave[slaveid]).bootStart = rtuClock();
-                
-                //SM_RUN_MACHINE(d, i);
-                START_SM(ds302_data._bootSlave[slaveid], d, slaveid);
-            } else {
-                
-                // it's unused based on state, BootUnused.
-                
-                // zero out the start time to indicate unused
-                //SM_DATA(i,start_time) = 0;
-            }
+        // the nodes not in the list keep their machines unused, BootUnused
+        DS302_NL_FOREACH (ds302_nl(d)->slave, slaveid) {
+            // it's a slave, so start it's machine
+            
+            // mark the machine as used
+            DATA_SM (ds302->_bootSlave[slaveid]).state = BootInitialised;
+            
+            // mark the start time
+            //SM_DATA(i,start_time) = rtuClock();
+            DATA_SM(ds302->_bootSlave[slaveid]).bootStart = rtuClock();
+            
+            //SM_RUN_MACHINE(d, i);
+            START_SM(ds302->_bootSlave[slaveid], d, slaveid);
+        }
         // at this point we're done here
     } 
 
@@ -1235,11 +1797,12 @@ void _sm_BootMaster_bootproc (CO_Data* d, UNS32 idx)
     // if all are done, re-do the mandatory check and switch, or RAISE HELL (all machines done but NO JOY on mandatory)
     int	all_slaves_booted = 1;
     
-    for (slaveid=1; slaveid<NMT_MAX_NODE_ID; slaveid++) {
-        if (DATA_SM (ds302_data._bootSlave[slaveid]).state != BootUnused)
+    // only slaves in the network list get a machine started
+    DS302_NL_FOREACH (ds302_nl(d)->slave, slaveid) {
+        if (DATA_SM (ds302->_bootSlave[slaveid]).state != BootUnused)
         {
             // machine is in use, so work it
-            if (RUNNING_SM(ds302_data._bootSlave[slaveid])) {
+            if (RUNNING_SM(ds302->_bootSlave[slaveid])) {
                 // machine still running, skip it
                 DS302_DEBUG("Slave boot %d still running\n", slaveid);
                 all_slaves_booted = 0;
@@ -1247,7 +1810,7 @@ void _sm_BootMaster_bootproc (CO_Data* d, UNS32 idx)
             }
             
             // at this point we found a used SM that is no longer running
-            if (!STOPPED_SM(ds302_data._bootSlave[slaveid])) {
+            if (!STOPPED_SM(ds302->_bootSlave[slaveid])) {
                 // small sanity checking, it SHOULD be stopped
                 DS302_DEBUG ("Found a used SM not running and NOT stopped, %d", slaveid);
             }
@@ -1256,16 +1819,16 @@ void _sm_BootMaster_bootproc (CO_Data* d, UNS32 idx)
             
             DS302_DEBUG("Slave boot %d finished\n");
             
-            _sm_BootSlave_Codes     result = DATA_SM(ds302_data._bootSlave[slaveid]).result;
+            _sm_BootSlave_Codes     result = DATA_SM(ds302->_bootSlave[slaveid]).result;
             
             //if not mandatory slave, signal boot attempted
             if (!ds302_nl_mandatory_node(d, slaveid)) {
-                DATA_SM (ds302_data._bootSlave[slaveid]).state = BootAttempted;
+                DATA_SM (ds302->_bootSlave[slaveid]).state = BootAttempted;
             }
             
             if (result == SM_ErrB) {
                 // get current time
-                uint64_t		elapsedTime = rtuClock() - DATA_SM (ds302_data._bootSlave[slaveid]).bootStart;
+                uint64_t		elapsedTime = rtuClock() - DATA_SM (ds302->_bootSlave[slaveid]).bootStart;
                 
                 DS302_DEBUG ("Got status B for SM %d, elapsed time %d\n", slaveid, elapsedTime);
                 
@@ -1275,15 +1838,15 @@ void _sm_BootMaster_bootproc (CO_Data* d, UNS32 idx)
                         // boot expired for this
                         DS302_DEBUG("Boot expired for mandatory slave %d (time %d)\n", slaveid, elapsedTime);
                         // signal result
-                        DATA_SM (ds302_data._bootSlave[slaveid]).state = BootTimedOut;
+                        DATA_SM (ds302->_bootSlave[slaveid]).state = BootTimedOut;
                         continue;
                         
                     } else {
                         // re-initialize the state machine
                         
                         DS302_DEBUG("Boot time not expired for slave %d, rescheduling\n", slaveid);
-                        INIT_SM (BOOTSLAVE, ds302_data._bootSlave[slaveid], SM_BOOTSLAVE_INITIAL);
-                        START_SM (ds302_data._bootSlave[slaveid], d, slaveid);
+                        INIT_SM (BOOTSLAVE, ds302->_bootSlave[slaveid], SM_BOOTSLAVE_INITIAL);
+                        START_SM (ds302->_bootSlave[slaveid], d, slaveid);
                         
                         // mark that we're not done yet
                         all_slaves_booted = 0;
@@ -1297,12 +1860,12 @@ void _sm_BootMaster_bootproc (CO_Data* d, UNS32 idx)
                 // we ended with a boot error and it wasn't B
                 DS302_DEBUG("Result is NOT OK, BootTimedOut for %d <|==\n", slaveid);
                 // signal state
-                DATA_SM (ds302_data._bootSlave[slaveid]).state = BootError;
+                DATA_SM (ds302->_bootSlave[slaveid]).state = BootError;
             } else {
                 // we ended with a successfull run
                 DS302_DEBUG("Result is OK, BootCompleted for %d <---\n", slaveid);
                 // signal state
-                DATA_SM (ds302_data._bootSlave[slaveid]).state = BootCompleted;
+                DATA_SM (ds302->_bootSlave[slaveid]).state = BootCompleted;
             }
         } else {
             // unused machine, skip
@@ -1316,31 +1879,32 @@ void _sm_BootMaster_bootproc (CO_Data* d, UNS32 idx)
         // re-verify if we are done here
         if (ds302_all_mandatory_booted(d)) {
             // switch to the next step
-            SWITCH_SM(ds302_data._masterBoot, MB_OPERWAIT, d, idx);
+            SWITCH_SM(ds302->_masterBoot, MB_OPERWAIT, d, idx);
             return;
         } else {
             // well, crap
             DS302_DEBUG ("ALL DONE BUT NOT FINISHED!!!\n");
-            STOP_SM(ds302_data._masterBoot);
+            STOP_SM(ds302->_masterBoot);
             return;
         }
     } else {
         // we still have slaves to manage
-        //DS302_DEBUG("BM: not all done, waiting 100ms\n");
-        // set alarm for 100ms for this function
-        //DS302_DEBUG("_sm_BootMaster_bootproc ALARM SET to %d\n", ++idx);
-        SetAlarm (d, ++idx, _sm_BootMaster_bootproc, MS_TO_TIMEVAL(100), 0);
+        // finishing slave machines wake us up (_ds302_slave_done), keep a slow poll as a fallback
+        // unless one of them already asked for a run
+        if (ds302->masterTimer == TIMER_NONE)
+            _ds302_master_alarm (d, ++idx, DS302_MASTER_POLL_MS);
     }
 }
 
 void _sm_BootMaster_operwait (CO_Data* d, UNS32 idx)
 {
+    ds302_t     *ds302 = ds302_ctx (d);
     DS302_DEBUG ("_sm_BootMaster_operwait ENTRY (%d)\n", idx);
 
-    if (INITIAL_SM(ds302_data._masterBoot)) {
+    if (INITIAL_SM(ds302->_masterBoot)) {
         if (!ds302_all_mandatory_booted(d)) {
             eprintf ("We should not be here, but here we are! Not ALL mandatory booted OK\n");
-            STOP_SM(ds302_data._masterBoot);
+            STOP_SM(ds302->_masterBoot);
             return;
         }
 
@@ -1352,7 +1916,7 @@ void _sm_BootMaster_operwait (CO_Data* d, UNS32 idx)
             setState(d, Operational);
 
             // switch to start slaves
-            SWITCH_SM(ds302_data._masterBoot, MB_SLAVESTART, d, idx);
+            SWITCH_SM(ds302->_masterBoot, MB_SLAVESTART, d, idx);
             return;
         }
     }
@@ -1364,19 +1928,22 @@ void _sm_BootMaster_operwait (CO_Data* d, UNS32 idx)
         DS302_DEBUG("Was put externally into operational, switching to MB_SLAVESTART\n");
         
         // switch to start slaves
-        SWITCH_SM(ds302_data._masterBoot, MB_SLAVESTART, d, idx);
+        SWITCH_SM(ds302->_masterBoot, MB_SLAVESTART, d, idx);
         return;
     }
 
-    DS302_DEBUG("_sm_BootMaster_bootproc ALARM SET to %d\n", ++idx);
-    SetAlarm (d, idx, _sm_BootMaster_bootproc, MS_TO_TIMEVAL(100), 0);
+    // ds302_notify_master wakes us up when the master is put in operational
+    DS302_DEBUG("_sm_BootMaster_operwait ALARM SET to %d\n", ++idx);
+    if (ds302->masterTimer == TIMER_NONE)
+        _ds302_master_alarm (d, idx, DS302_MASTER_POLL_MS);
 }
 
 void _sm_BootMaster_slavestart (CO_Data* d, UNS32 idx)
 {
+    ds302_t     *ds302 = ds302_ctx (d);
     DS302_DEBUG ("_sm_BootMaster_slavestart ENTRY (%d)\n", idx);
 
-        if (INITIAL_SM(ds302_data._masterBoot)) {
+        if (INITIAL_SM(ds302->_masterBoot)) {
 
             // Only execute this when I am operational
             // this enables multiple executions for this function
@@ -1394,9 +1961,9 @@ void _sm_BootMaster_slavestart (CO_Data* d, UNS32 idx)
                             //start slaves individually
                             int slaveid;
                             int myid = getNodeId(d);
-                            for (slaveid=1; slaveid < NMT_MAX_NODE_ID; slaveid++) {
+                            DS302_NL_FOREACH (ds302_nl(d)->slave, slaveid) {
                                     // make sure to skip myself
-                                    if ((slaveid != myid) && ds302_nl_node_in_list(d, slaveid))
+                                    if (slaveid != myid)
                                             masterSendNMTstateChange (d, slaveid, NMT_Start_Node);
                             }
                     }
@@ -1405,10 +1972,10 @@ void _sm_BootMaster_slavestart (CO_Data* d, UNS32 idx)
 
     DS302_DEBUG("MasterBoot - STOP STATE MACHINE (%d). We completed the boot process\n", idx);
     // should not end up here, but just in case
-    STOP_SM(ds302_data._masterBoot);
+    STOP_SM(ds302->_masterBoot);
     
     // mark boot completed
-    ds302_data.bootState = BootCompleted;
+    ds302->bootState = BootCompleted;
 }
 
 /*
@@ -1417,33 +1984,40 @@ void _sm_BootMaster_slavestart (CO_Data* d, UNS32 idx)
 */
 void ds302_boot_slave (CO_Data* d, UNS8 slaveid)
 {
+    ds302_t     *ds302 = ds302_ctx (d);
     // guard against double restarts. Start machine must be NOT be running
-    if (ds302_nl_node_in_list(d, slaveid) && !RUNNING_SM(ds302_data._bootSlave[slaveid])) {
+    if (ds302_nl_node_in_list(d, slaveid) && !RUNNING_SM(ds302->_bootSlave[slaveid])) {
+        // guarding starts again at the end of the boot, if configured
+        ds302_ng_stop (d, slaveid);
         ds302_init_slaveSM (d, slaveid);
         // mark the machine as used
-        DATA_SM (ds302_data._bootSlave[slaveid]).state = BootInitialised;
+        DATA_SM (ds302->_bootSlave[slaveid]).state = BootInitialised;
         // mark the start time
-        DATA_SM(ds302_data._bootSlave[slaveid]).bootStart = rtuClock();
-        START_SM(ds302_data._bootSlave[slaveid], d, slaveid);
+        DATA_SM(ds302->_bootSlave[slaveid]).bootStart = rtuClock();
+        START_SM(ds302->_bootSlave[slaveid], d, slaveid);
     }
 }
 
 void ds302_init_slaveSM (CO_Data* d, UNS8 slaveid)
 {
+    ds302_t     *ds302 = ds302_ctx (d);
     // init the slave SM
-    INIT_SM (BOOTSLAVE, ds302_data._bootSlave[slaveid], SM_BOOTSLAVE_INITIAL);
+    INIT_SM (BOOTSLAVE, ds302->_bootSlave[slaveid], SM_BOOTSLAVE_INITIAL);
     // init the slave data
-    DATA_SM (ds302_data._bootSlave[slaveid]).state = BootUnused;
-    DATA_SM (ds302_data._bootSlave[slaveid]).result = SM_Initialised;
-    DATA_SM (ds302_data._bootSlave[slaveid]).ViaDPath = 0;
-    DATA_SM (ds302_data._bootSlave[slaveid]).bootStart = 0;
-    DATA_SM (ds302_data._bootSlave[slaveid]).Index1000 = 0x0;
-    DATA_SM (ds302_data._bootSlave[slaveid]).Index1018_1 = 0x0;
-    DATA_SM (ds302_data._bootSlave[slaveid]).Index1018_2 = 0x0;
-    DATA_SM (ds302_data._bootSlave[slaveid]).Index1018_3 = 0x0;
-    DATA_SM (ds302_data._bootSlave[slaveid]).Index1018_4 = 0x0;
-    DATA_SM (ds302_data._bootSlave[slaveid]).Index1020_1 = 0x0;
-    DATA_SM (ds302_data._bootSlave[slaveid]).Index1020_2 = 0x0;
+    DATA_SM (ds302->_bootSlave[slaveid]).state = BootUnused;
+    DATA_SM (ds302->_bootSlave[slaveid]).result = SM_Initialised;
+    DATA_SM (ds302->_bootSlave[slaveid]).ViaDPath = 0;
+    DATA_SM (ds302->_bootSlave[slaveid]).bootStart = 0;
+    DATA_SM (ds302->_bootSlave[slaveid]).hbTimer = TIMER_NONE;
+    DATA_SM (ds302->_bootSlave[slaveid]).Index1000 = 0x0;
+    DATA_SM (ds302->_bootSlave[slaveid]).Index1018_1 = 0x0;
+    DATA_SM (ds302->_bootSlave[slaveid]).Index1018_2 = 0x0;
+    DATA_SM (ds302->_bootSlave[slaveid]).Index1018_3 = 0x0;
+    DATA_SM (ds302->_bootSlave[slaveid]).Index1018_4 = 0x0;
+    DATA_SM (ds302->_bootSlave[slaveid]).Index1020_1 = 0x0;
+    DATA_SM (ds302->_bootSlave[slaveid]).Index1020_2 = 0x0;
+    DATA_SM (ds302->_bootSlave[slaveid]).Expected1020_1 = 0x0;
+    DATA_SM (ds302->_bootSlave[slaveid]).Expected1020_2 = 0x0;
 }
 
 void _ds302_boot_completed (CO_Data* d, UNS8 masterid) {};
@@ -1451,32 +2025,42 @@ void _ds302_boot_completed (CO_Data* d, UNS8 masterid) {};
 /* initialises the DS 302 structure */
 void ds302_init (CO_Data* d)
 {
+    ds302_t     *ds302 = ds302_ctx (d);
     // init the DS-302 master data
-    ds302_data.bootState = BootInitialised;
-    INIT_SM (BOOTMASTER, ds302_data._masterBoot, MB_INITIAL);
+    ds302->bootState = BootInitialised;
+    INIT_SM (BOOTMASTER, ds302->_masterBoot, MB_INITIAL);
+    ds302->masterTimer = TIMER_NONE;
+    memset (&ds302->guard, 0, sizeof (ds302->guard));
+    ds302->guard.timer = TIMER_NONE;
+    memset (ds302->hb, 0, sizeof (ds302->hb));
+    memset (ds302->hbmap, 0, sizeof (ds302->hbmap));
     
     // initialize the slave state machines
     int slaveid;
     for (slaveid = 1; slaveid < NMT_MAX_NODE_ID; slaveid ++){
         // init the slave SM
-        INIT_SM (BOOTSLAVE, ds302_data._bootSlave[slaveid], SM_BOOTSLAVE_INITIAL);
+        INIT_SM (BOOTSLAVE, ds302->_bootSlave[slaveid], SM_BOOTSLAVE_INITIAL);
         // init the slave data
-        DATA_SM (ds302_data._bootSlave[slaveid]).state = BootUnused;
-        DATA_SM (ds302_data._bootSlave[slaveid]).result = SM_Initialised;
-        DATA_SM (ds302_data._bootSlave[slaveid]).ViaDPath = 0;
-        DATA_SM (ds302_data._bootSlave[slaveid]).bootStart = 0;
-        DATA_SM (ds302_data._bootSlave[slaveid]).Index1000 = 0x0;
-        DATA_SM (ds302_data._bootSlave[slaveid]).Index1018_1 = 0x0;
-        DATA_SM (ds302_data._bootSlave[slaveid]).Index1018_2 = 0x0;
-        DATA_SM (ds302_data._bootSlave[slaveid]).Index1018_3 = 0x0;
-        DATA_SM (ds302_data._bootSlave[slaveid]).Index1018_4 = 0x0;
-        DATA_SM (ds302_data._bootSlave[slaveid]).Index1020_1 = 0x0;
-        DATA_SM (ds302_data._bootSlave[slaveid]).Index1020_2 = 0x0;
+        DATA_SM (ds302->_bootSlave[slaveid]).state = BootUnused;
+        DATA_SM (ds302->_bootSlave[slaveid]).result = SM_Initialised;
+        DATA_SM (ds302->_bootSlave[slaveid]).ViaDPath = 0;
+        DATA_SM (ds302->_bootSlave[slaveid]).bootStart = 0;
+        DATA_SM (ds302->_bootSlave[slaveid]).hbTimer = TIMER_NONE;
+        DATA_SM (ds302->_bootSlave[slaveid]).Index1000 = 0x0;
+        DATA_SM (ds302->_bootSlave[slaveid]).Index1018_1 = 0x0;
+        DATA_SM (ds302->_bootSlave[slaveid]).Index1018_2 = 0x0;
+        DATA_SM (ds302->_bootSlave[slaveid]).Index1018_3 = 0x0;
+        DATA_SM (ds302->_bootSlave[slaveid]).Index1018_4 = 0x0;
+        DATA_SM (ds302->_bootSlave[slaveid]).Index1020_1 = 0x0;
+        DATA_SM (ds302->_bootSlave[slaveid]).Index1020_2 = 0x0;
+        DATA_SM (ds302->_bootSlave[slaveid]).Expected1020_1 = 0x0;
+        DATA_SM (ds302->_bootSlave[slaveid]).Expected1020_2 = 0x0;
+        ds302->dcfNoBlock[slaveid] = 0;
     }
     
     // put a dummy callback for boot completed
     // not used right now
-    ds302_data.bootFinished = _ds302_boot_completed;
+    ds302->bootFinished = _ds302_boot_completed;
     // ready to proceed. Need to decide if we boot ON-DEMAND or we rely on boot messages
     // relying on boot messages seems to be a problem
     // we can WAIT for a boot message before starting the boot process for example
@@ -1485,16 +2069,35 @@ void ds302_init (CO_Data* d)
     // since 302 deals with booting, and error control, we need to take over those callbacks
     // however, need to be careful since this brings quite a lot of functionality into 302
     // But, since 302 is a "framework for CANopen Managers", this is within scope
+    // the user bootup callback is kept and chained
+    ds302->slaveBootup = d->post_SlaveBootup;
     d->post_SlaveBootup = _onSlaveBootCB;
     d->post_emcy = _onEMCY;
+    // network list cache, dropped on any write to 0x1F80/0x1F81
+    ds302->nl.valid = 0;
+    RegisterSetODentryCallBack (d, 0x1F80, 0x00, _ds302_nl_changed);
+    for (slaveid = 1; slaveid < NMT_MAX_NODE_ID; slaveid ++)
+        if (RegisterSetODentryCallBack (d, 0x1F81, slaveid, _ds302_nl_changed) != OD_SUCCESSFUL)
+            break;
+
+    // heartbeat frames drive the error control wait. The user callback is kept and chained
+    ds302->slaveStateChange = d->post_SlaveStateChange;
+    d->post_SlaveStateChange = _onSlaveStateChange;
+    // going operational externally releases the boot master, same chaining
+    ds302->operational = d->operational;
+    d->operational = _onOperational;
+    // heartbeat misses are counted in the statistics
+    ds302->heartbeatError = d->heartbeatError;
+    d->heartbeatError = _onHeartbeatError;
 }
 
 void ds302_start (CO_Data* d)
 {
-    ds302_data.bootState = BootRunning;
+    ds302_t     *ds302 = ds302_ctx (d);
+    ds302->bootState = BootRunning;
     
     // start the boot with a idx above the CAN IDs
-    START_SM(ds302_data._masterBoot, d, NMT_MAX_NODE_ID);
+    START_SM(ds302->_masterBoot, d, NMT_MAX_NODE_ID);
 }
 
 /*
@@ -1502,7 +2105,8 @@ void ds302_start (CO_Data* d)
 */
 ds302_boot_state_t  ds302_status (CO_Data* d)
 {
-    return ds302_data.bootState;
+    ds302_t     *ds302 = ds302_ctx (d);
+    return ds302->bootState;
 }
 
 /*
@@ -1510,17 +2114,20 @@ ds302_boot_state_t  ds302_status (CO_Data* d)
 */
 ds302_boot_state_t  ds302_node_status (CO_Data* d, UNS8 nodeid)
 {
-    return DATA_SM (ds302_data._bootSlave[nodeid]).state;
+    ds302_t     *ds302 = ds302_ctx (d);
+    return DATA_SM (ds302->_bootSlave[nodeid]).state;
 }
 
 _sm_BootSlave_Codes ds302_node_result (CO_Data* d, UNS8 nodeid)
 {
-    return DATA_SM (ds302_data._bootSlave[nodeid]).result;
+    ds302_t     *ds302 = ds302_ctx (d);
+    return DATA_SM (ds302->_bootSlave[nodeid]).result;
 }
 
 UNS32   ds302_node_error (CO_Data* d, UNS8 nodeid)
 {
-    return DATA_SM (ds302_data._bootSlave[nodeid]).errorCode;
+    ds302_t     *ds302 = ds302_ctx (d);
+    return DATA_SM (ds302->_bootSlave[nodeid]).errorCode;
 }
 
 /*
@@ -1567,6 +2174,55 @@ int     ds302_get_next_dcf (UNS8 *data, UNS32 *cursor, UNS16 *idx, UNS8 *subidx,
     return 1;
 }
 
+/*
+    Walks the concise DCF entries and returns the bytes used by them, including the count
+    The domain size in 0x1F22 is the buffer size, not the used length
+    returns 0 if the entries run past size
+*/
+UNS32   ds302_dcf_length (UNS8 *data, UNS32 size)
+{
+    if (data == NULL || size < 4)
+        return 0;
+
+    UNS32   count = data[0] | data[1]<<8 | data[2]<<16 | data[3]<<24;
+    UNS32   cursor = 4;
+
+    while (count--) {
+        // index, subindex and the data size
+        if (cursor + 7 > size)
+            return 0;
+        UNS32   itemsize = data[cursor+3] | data[cursor+4]<<8 | data[cursor+5]<<16 | data[cursor+6]<<24;
+        cursor += 7;
+        if (itemsize > size - cursor)
+            return 0;
+        cursor += itemsize;
+    }
+
+    return cursor;
+}
+
+/*
+    Hashes the used part of a concise DCF (64 bit FNV-1a), split as configuration date/time
+    Zero means "don't care" in 0x1F26/0x1F27, so neither half is ever zero
+*/
+void    ds302_dcf_hash (UNS8 *data, UNS32 length, UNS32 *date, UNS32 *time)
+{
+    uint64_t    hash = 0xCBF29CE484222325ULL;
+    UNS32       i;
+
+    for (i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001B3ULL;
+    }
+
+    *date = (UNS32)(hash >> 32);
+    *time = (UNS32)hash;
+    if (*date == 0)
+        *date = 1;
+    if (*time == 0)
+        *time = 1;
+}
+
 /*
     Loads the DCF data for the local node
 */
@@ -1653,6 +2309,7 @@ int     ds302_load_dcf_local (CO_Data* d)
 }
 
 int ds302_setHeartbeat (CO_Data* d, UNS8 nodeid, UNS16 heartbeat) {
+    ds302_t     *ds302 = ds302_ctx (d);
     
     UNS32               errorCode;
     UNS32               hbdata;
@@ -1674,26 +2331,100 @@ int ds302_setHeartbeat (CO_Data* d, UNS8 nodeid, UNS16 heartbeat) {
         return 0;
     }
     
+    // heartbeat statistics, the arrivals are watched from the wheel tick
+    if (nodeid < NMT_MAX_NODE_ID) {
+        ds302_hbstat_t *    hb = &ds302->hb[nodeid];
+        UNS32               seq;
+
+        if (hb->armed && d->NMTable[nodeid] == Unknown_state)
+            d->NMTable[nodeid] = hb->lastState;
+        _ds302_hb_write (hb);
+        seq = hb->seq;
+        memset (hb, 0, sizeof (*hb));
+        hb->seq = seq;
+        _ds302_hb_written (hb);
+
+        // the arrivals are picked up on the wheel ticks, a heartbeat faster than a few ticks
+        // would add up several frames per interval. The consumer still runs, without statistics
+        if (heartbeat > 0 && heartbeat < DS302_HB_MIN_TICKS * DS302_NG_TICK_MS) {
+            EPOS_WARN ("heartbeat of CAN ID %02x (%d ms) too fast for the statistics, under %d ms\n",
+                nodeid, heartbeat, DS302_HB_MIN_TICKS * DS302_NG_TICK_MS);
+            NL_CLR (ds302->hbmap, nodeid);
+        } else if (heartbeat > 0) {
+            hb->timeout = heartbeat;
+            hb->active = 1;
+            NL_SET (ds302->hbmap, nodeid);
+            _ds302_ng_timer (d);
+        } else {
+            NL_CLR (ds302->hbmap, nodeid);
+        }
+    }
+    
     return 1;
 }
 
+int ds302_hb_stats (CO_Data* d, UNS8 nodeid, ds302_hbstat_t *stats)
+{
+    ds302_t     *ds302 = ds302_ctx (d);
+    const volatile ds302_hbstat_t * hb;
+    UNS32       seq;
+    int         tries;
+
+    if (nodeid < 1 || nodeid >= NMT_MAX_NODE_ID || !ds302->hb[nodeid].active)
+        return 0;
+
+    hb = &ds302->hb[nodeid];
+    // the writer holds the CanFestival lock for a few stores only, do not spin in RT
+    for (tries = 0; tries < DS302_HB_READ_TRIES; tries++) {
+        seq = hb->seq;
+        __sync_synchronize();
+        *stats = *(const ds302_hbstat_t *)hb;
+        __sync_synchronize();
+        if (!(seq & 1) && seq == hb->seq)
+            return 1;
+    }
+
+    return 0;
+}
+
+INTEGER32 ds302_hb_margin (const ds302_hbstat_t *stats)
+{
+    int64_t     left;
+
+    if (stats->last == 0)
+        return 0;
+
+    left = (int64_t)stats->timeout * 1000 - (int64_t)(rtuClock() - stats->last);
+    return left > 0 ? (INTEGER32)left : 0;
+}
+
+void ds302_hb_reset (CO_Data* d, UNS8 nodeid)
+{
+    ds302_t     *ds302 = ds302_ctx (d);
+    if (nodeid > 0 && nodeid < NMT_MAX_NODE_ID)
+        ds302->hb[nodeid].reset = 1;
+}
+
 /*
     This is called on detection of a bootup message
     This can be either called during the initial boot stage, or it can be called outside of item
     For example, a node resets
 */
 void    _onSlaveBootCB (CO_Data* d, UNS8 nodeid) {
+    ds302_t     *ds302 = ds302_ctx (d);
     
     // inform the user about the event
     EPOS_WARN("received bootup message from CAN ID %02x\n", nodeid);
+    if (ds302->slaveBootup)
+        ds302->slaveBootup (d, nodeid);
     
     // verify if slave is in Network List
     if (ds302_nl_node_in_list(d, nodeid)) {        
         // verify if slave boot allowed
-        if (ds302_bitcheck_32(d, 0x1F81, nodeid, DS302_NL_ONBOOT_START_SLAVE) == 1) {
+        if (NL_TEST (ds302_nl(d)->autostart, nodeid)) {
             // boot the node
             EPOS_WARN ("Booting/configuring CAN ID %02x\n", nodeid);
-            ds302_clear_errors (nodeid);
+            ds302_clear_errors (d, nodeid);
             ds302_boot_slave (d, nodeid);
         } else {
             EPOS_WARN ("Automatic boot for CAN ID %02x disabled (0x1F81/%02x, bit 2 is off)\n", nodeid, nodeid);
@@ -1703,6 +2434,69 @@ void    _onSlaveBootCB (CO_Data* d, UNS8 nodeid) {
     }
 }
 
+/*
+    This is called when a slave NMT state changes (heartbeat, node guard or bootup frames)
+    A slave machine waiting for the first heartbeat proceeds right away
+*/
+void    _onSlaveStateChange (CO_Data* d, UNS8 nodeid, e_nodeState newNodeState) {
+    ds302_t     *ds302 = ds302_ctx (d);
+
+    if (nodeid < NMT_MAX_NODE_ID && RUNNING_SM(ds302->_bootSlave[nodeid]) &&
+        ds302->_bootSlave[nodeid].machine_state == SM_BOOTSLAVE_WAIT_HB) {
+        // CanFestival stores the new state only after this callback, the machine reads it
+        d->NMTable[nodeid] = newNodeState;
+        RUN_SM(ds302->_bootSlave[nodeid], d, nodeid);
+    }
+
+    // a heartbeat frame, after the wheel tick re-armed the node only real changes are passed
+    if (nodeid < NMT_MAX_NODE_ID && ds302->hb[nodeid].active && !ds302->guard.node[nodeid].active) {
+        int     armed = ds302->hb[nodeid].armed;
+
+        _ds302_hb_arrival (d, nodeid, newNodeState);
+        if (armed && newNodeState == ds302->hb[nodeid].lastState)
+            return;
+    }
+
+    // a guard answer takes the node out of Unknown_state every guard time, only pass real changes
+    if (nodeid < NMT_MAX_NODE_ID && ds302->guard.node[nodeid].active && ds302->guard.node[nodeid].pending &&
+        d->NMTable[nodeid] == Unknown_state && newNodeState == ds302->guard.node[nodeid].lastState)
+        return;
+
+    if (ds302->slaveStateChange)
+        ds302->slaveStateChange (d, nodeid, newNodeState);
+}
+
+/*
+    This is called when a heartbeat consumer time elapses (CanFestival marks the node Disconnected)
+*/
+void    _onHeartbeatError (CO_Data* d, UNS8 nodeid) {
+    ds302_t     *ds302 = ds302_ctx (d);
+
+    if (nodeid < NMT_MAX_NODE_ID && ds302->hb[nodeid].active) {
+        _ds302_hb_write (&ds302->hb[nodeid]);
+        ds302->hb[nodeid].misses++;
+        // the next heartbeat starts a new interval
+        ds302->hb[nodeid].last = 0;
+        _ds302_hb_written (&ds302->hb[nodeid]);
+        ds302->hb[nodeid].armed = 0;
+    }
+
+    if (ds302->heartbeatError)
+        ds302->heartbeatError (d, nodeid);
+}
+
+/*
+    This is called when the master enters operational
+*/
+void    _onOperational (CO_Data* d) {
+    ds302_t     *ds302 = ds302_ctx (d);
+
+    ds302_notify_master (d);
+
+    if (ds302->operational)
+        ds302->operational (d);
+}
+
 /*
     This is called on receipt of EMCY frames
 */
@@ -1720,8 +2514,8 @@ void    _onEMCY(CO_Data* d, UNS8 nodeid, UNS16 errCode, UNS8 errReg, const UNS8*
     // check here for 0x0000 error code and 0x00 error register
     if (errCode == 0x0000 && errReg == 0x00) {
         // no errors present on the device
-        ds302_clear_errors (nodeid);
-    } else if (!ds302_add_error (nodeid, errCode, errReg, errSpec)) {
+        ds302_clear_errors (d, nodeid);
+    } else if (!ds302_add_error (d, nodeid, errCode, errReg, errSpec)) {
         EPOS_WARN ("error stack for %02x is full\n", nodeid);
     }
 }
@@ -1730,10 +2524,11 @@ void    _onEMCY(CO_Data* d, UNS8 nodeid, UNS16 errCode, UNS8 errReg, const UNS8*
     Clears the errors for a specific node
     Called either from the init, or from EMCY when no errors
 */
-void    ds302_clear_errors (UNS8 nodeid) {
+void    ds302_clear_errors (CO_Data* d, UNS8 nodeid) {
+    ds302_t     *ds302 = ds302_ctx (d);
     
     if (nodeid > 0 && nodeid < NMT_MAX_NODE_ID) {
-        ds302_data.deviceErrors[nodeid].errCount = 0;
+        ds302->deviceErrors[nodeid].errCount = 0;
     }
 }
 
@@ -1741,26 +2536,27 @@ void    ds302_clear_errors (UNS8 nodeid) {
     Add an error to the error stack
     Called from the emcy OR we can add a error manually from the software
 */
-int     ds302_add_error (UNS8 nodeid, UNS16 errCode, UNS8 errReg, const UNS8* errSpec) {
+int     ds302_add_error (CO_Data* d, UNS8 nodeid, UNS16 errCode, UNS8 errReg, const UNS8* errSpec) {
+    ds302_t     *ds302 = ds302_ctx (d);
     
     /* check if we have room in the stack. Errors are DISCARDED if not */
-    if (nodeid > 0 && nodeid < NMT_MAX_NODE_ID && ds302_data.deviceErrors[nodeid].errCount < EPOS_MAX_ERRORS) {
+    if (nodeid > 0 && nodeid < NMT_MAX_NODE_ID && ds302->deviceErrors[nodeid].errCount < EPOS_MAX_ERRORS) {
 
-        ds302_data.deviceErrors[nodeid].errors[ds302_data.deviceErrors[nodeid].errCount].errCode = errCode;
-        ds302_data.deviceErrors[nodeid].errors[ds302_data.deviceErrors[nodeid].errCount].errReg = errReg;
+        ds302->deviceErrors[nodeid].errors[ds302->deviceErrors[nodeid].errCount].errCode = errCode;
+        ds302->deviceErrors[nodeid].errors[ds302->deviceErrors[nodeid].errCount].errReg = errReg;
         if (errSpec != NULL) {
             int     i;
             for (i = 0; i < 5; i++){
-                ds302_data.deviceErrors[nodeid].errors[ds302_data.deviceErrors[nodeid].errCount].errData[i] = errSpec[i];
+                ds302->deviceErrors[nodeid].errors[ds302->deviceErrors[nodeid].errCount].errData[i] = errSpec[i];
             }
         } else { // clear the data just to make sure
             int     i;
             for (i = 0; i < 5; i++){
-                ds302_data.deviceErrors[nodeid].errors[ds302_data.deviceErrors[nodeid].errCount].errData[i] = 0;
+                ds302->deviceErrors[nodeid].errors[ds302->deviceErrors[nodeid].errCount].errData[i] = 0;
             }            
         }
         // error added, increment
-        ds302_data.deviceErrors[nodeid].errCount++;
+        ds302->deviceErrors[nodeid].errCount++;
         return 1;
     }
     
@@ -1768,10 +2564,11 @@ int     ds302_add_error (UNS8 nodeid, UNS16 errCode, UNS8 errReg, const UNS8* er
 }
 
 /* returns the error count for a device */
-int     ds302_get_error_count (UNS8 nodeid) {
+int     ds302_get_error_count (CO_Data* d, UNS8 nodeid) {
+    ds302_t     *ds302 = ds302_ctx (d);
     
     if (nodeid > 0 && nodeid < NMT_MAX_NODE_ID) {
-        return ds302_data.deviceErrors[nodeid].errCount;
+        return ds302->deviceErrors[nodeid].errCount;
     }
     
     return -1;
@@ -1793,13 +2590,13 @@ int     ds302_get_error_count (UNS8 nodeid) {
 
 int     ds302_node_healthy (CO_Data* d, UNS8 nodeid) {
     
-    if (getNodeState(d, nodeid) != Operational)
+    if (ds302_node_state(d, nodeid) != Operational)
         return 0;
     
     if (ds302_node_result (d, nodeid) != SM_OK)
         return 0;
     
-    if (ds302_get_error_count (nodeid) > 0)
+    if (ds302_get_error_count (d, nodeid) > 0)
         return 0;
         
     return 1;
@@ -43,6 +43,7 @@ typedef enum {
     SM_BOOTSLAVE_VERIFY_CONFVER_1,
     SM_BOOTSLAVE_VERIFY_CONFVER_2,
     SM_BOOTSLAVE_DOWNLOAD_CONFIG,
+    SM_BOOTSLAVE_STORE_CONFVER,
     SM_BOOTSLAVE_START_ERRCTL,
     SM_BOOTSLAVE_WAIT_HB,
     SM_BOOTSLAVE_START_NODEGUARD,
@@ -185,6 +186,32 @@ Eq. verifies if it has the slave bit set for it's index under 0x1F81
 */
 int ds302_nl_node_in_list(CO_Data* d, UNS8 nodeid);
 
+/*
+Network list cache. One bit per node id, built from 0x1F80/0x1F81 on first use
+and dropped by the OD write callbacks on them
+*/
+#define DS302_NL_WORDS      ((NMT_MAX_NODE_ID + 31) / 32)
+
+typedef struct {
+    int     valid;                          // rebuilt on the next use when 0
+    UNS32   device;                         // 0x1F80
+    UNS32   entry[NMT_MAX_NODE_ID];         // 0x1F81, 0 past the OD subcount
+    UNS32   slave[DS302_NL_WORDS];          // in the network list
+    UNS32   mandatory[DS302_NL_WORDS];      // mandatory slave
+    UNS32   keepalive[DS302_NL_WORDS];      // slave not to be reset at boot
+    UNS32   autostart[DS302_NL_WORDS];      // slave booted on its bootup message
+} ds302_nl_cache_t;
+
+/* next node id set in a network list bitmap, starting at nodeid. NMT_MAX_NODE_ID when done */
+int ds302_nl_next (const UNS32 *map, int nodeid);
+
+/* walks the node ids set in a network list bitmap */
+#define DS302_NL_FOREACH(map, nodeid) \
+    for (nodeid = ds302_nl_next ((map), 1); nodeid < NMT_MAX_NODE_ID; nodeid = ds302_nl_next ((map), nodeid + 1))
+
+/* the network list cache, rebuilt if needed */
+const ds302_nl_cache_t *ds302_nl (CO_Data* d);
+
 
 typedef enum {
     BootUnused = 0,         // unused state machine, no slave defined
@@ -212,22 +239,69 @@ typedef struct {
 
     UNS32                   Index1020_1;    // Configuration date. 0x0000 means don't care
     UNS32                   Index1020_2;    // Configuration time. 0x0000 means don't care
+    UNS32                   Expected1020_1; // Expected configuration date, 0x1F26 or the DCF hash. 0x0000 means always download
+    UNS32                   Expected1020_2; // Expected configuration time, 0x1F27 or the DCF hash
+    UNS32                   confStep;       // Configuration version store step after a download
 
     uint64_t                bootStart;      // timestamp of the boot process start
     
     uint64_t                ecsStart;       // timestamp of the Error Control Service start for HB checks
+    TIMER_HANDLE            hbTimer;        // fallback alarm while waiting for the first heartbeat
     
     // DCF
     UNS32                   dcfCursor;      // DCF cursor for the SDO loads
     UNS8                    *dcfData;       // DCF data for the node
     UNS32                   dcfSize;        // DCF total data size for this slave
     UNS32                   dcfCount;       // DCF count of entries in the domain
-    UNS32                   dcfState;       // DCF state. 0 - writeInit, 1 - writeInProgress. Used to determine current state in the callback
+    UNS32                   dcfState;       // DCF state. 0 - writeInit, 1 - writeInProgress, 2 - block download in progress. Used to determine current state in the callback
     UNS32                   dcfLoadCount;   // DCF items loaded so far
 } _bootSlave_data_t;
 
 DECLARE_SM_TYPE(BOOTSLAVE, _sm_BootSlave_States, SDOCallback_t, _bootSlave_data_t);
 
+/*
+    Node guarding. Each guarded slave sits in one slot of a hashed timer wheel,
+    the wheel is turned by a single alarm
+*/
+typedef struct {
+    UNS8                    active;         // guarding running for the node
+    UNS8                    linked;         // still in a wheel slot (removal is lazy)
+    UNS8                    next;           // next node in the same slot, 0 ends the list
+    UNS8                    pending;        // a guard request is out
+    UNS8                    missed;         // guard requests in a row without an answer
+    UNS8                    retryFactor;    // 0x1F81 retry factor
+    UNS8                    lost;           // guarding error reported
+    UNS16                   guardTime;      // 0x1F81 guard time in ms
+    UNS16                   rounds;         // wheel turns left before the node is due
+    e_nodeState             lastState;      // state of the last answer
+} ds302_guard_t;
+
+typedef struct {
+    ds302_guard_t           node[NMT_MAX_NODE_ID];
+    UNS8                    slot[DS302_NG_WHEEL_SLOTS];     // first node in the slot, 0 is empty
+    UNS32                   cursor;                         // current slot
+    TIMER_HANDLE            timer;                          // the wheel alarm
+} ds302_guard_wheel_t;
+
+/*
+    Heartbeat consumer statistics. Arrivals are seen like the guard answers: the wheel tick
+    sets the NMT table to Unknown_state and the next heartbeat frame stores the state again
+*/
+typedef struct {
+    volatile UNS32          seq;            // odd while the CAN side updates the statistics
+    UNS8                    active;         // statistics running for the node
+    UNS8                    armed;          // NMT table set to Unknown_state, waiting for a frame
+    UNS8                    reset;          // clear the statistics on the next frame
+    UNS16                   timeout;        // 0x1016 consumer time in ms
+    e_nodeState             lastState;      // state of the last heartbeat
+    uint64_t                last;           // arrival of the last heartbeat in us, 0 after a miss or a bootup
+    UNS32                   min;            // shortest interval in us
+    UNS32                   max;            // longest interval in us
+    uint64_t                sum;            // sum of the intervals in us
+    UNS32                   count;          // intervals counted
+    UNS32                   misses;         // consumer time elapsed without a heartbeat
+} ds302_hbstat_t;
+
 /*
     DS 302 global structure holding all the DS 302 information
 */
@@ -251,10 +325,26 @@ typedef struct {
         
         SDOCallback_t           bootFinished;                               // boot finished callback
         
+        TIMER_HANDLE            masterTimer;                                // pending master boot alarm (notify or fallback poll)
+        post_SlaveStateChange_t slaveStateChange;                           // chained user slave state change callback
+        post_SlaveBootup_t      slaveBootup;                                // chained user bootup callback
+        operational_t           operational;                                // chained user operational callback
+        
+        UNS8                    dcfNoBlock[NMT_MAX_NODE_ID];                // slave refused the concise DCF block download
+        
+        ds302_nl_cache_t        nl;                                         // network list cache (0x1F80/0x1F81)
+        
+        ds302_guard_wheel_t     guard;                                      // node guarding
+        
+        ds302_hbstat_t          hb[NMT_MAX_NODE_ID];                        // heartbeat consumer statistics
+        UNS32                   hbmap[DS302_NL_WORDS];                      // nodes with heartbeat statistics
+        heartbeatError_t        heartbeatError;                             // chained user heartbeat error callback
+        
         device_errors_t         deviceErrors[NMT_MAX_NODE_ID];              // the error stack
 } ds302_t;
 
-extern ds302_t     ds302_data;
+/* the DS-302 context of a master OD, one per CAN bus (EPOS_CAN_BUSES) */
+ds302_t *ds302_ctx (CO_Data*);
 
 /* the clock function */
 uint64_t rtuClock();
@@ -267,6 +357,14 @@ void    ds302_start (CO_Data *);
 void    ds302_init_slaveSM (CO_Data*, UNS8);
 /* boot a slave */
 void    ds302_boot_slave (CO_Data*, UNS8);
+/* wakes up the master boot machine, if it waits on slaves or on operational */
+void    ds302_notify_master (CO_Data*);
+/* starts guarding a node, guard time in ms and retry factor */
+void    ds302_ng_start (CO_Data*, UNS8 nodeid, UNS16 guardTime, UNS8 retryFactor);
+/* stops guarding a node */
+void    ds302_ng_stop (CO_Data*, UNS8 nodeid);
+/* the NMT state of a node, hiding the guard request or heartbeat wait in flight */
+e_nodeState ds302_node_state (CO_Data*, UNS8 nodeid);
 /* Gets the overall DS-302 boot status */
 ds302_boot_state_t  ds302_status (CO_Data *);
 /* Gets a slave's boot status */
@@ -281,16 +379,16 @@ UNS32   ds302_node_error (CO_Data*, UNS8);
     add error nodeid, error code, error register, error data[5]
     returns 1 on success, 0 on failure
 */
-inline int  ds302_add_error (UNS8, UNS16, UNS8, const UNS8*);
+inline int  ds302_add_error (CO_Data*, UNS8, UNS16, UNS8, const UNS8*);
 /*
     clears the errors for a node
     clear errors nodeid
 */
-inline void ds302_clear_errors (UNS8);
+inline void ds302_clear_errors (CO_Data*, UNS8);
 /*
     gets the error count for a node
 */
-inline int  ds302_get_error_count (UNS8);
+inline int  ds302_get_error_count (CO_Data*, UNS8);
 /*
     checks the node health (NMT,Boot,errors)
     node healthy nodeid
@@ -299,10 +397,21 @@ inline int  ds302_node_healthy (CO_Data*, UNS8);
 
 /* DCF data defines/routines */
 int     ds302_get_next_dcf (UNS8 *data, UNS32 *cursor, UNS16 *idx, UNS8 *subidx, UNS32 *size, UNS32 *value);
+/* Gets the used length of a concise DCF (count + entries), 0 if it does not fit in size */
+UNS32   ds302_dcf_length (UNS8 *data, UNS32 size);
+/* Hashes a concise DCF into a configuration date/time pair (0x1020), both non-zero */
+void    ds302_dcf_hash (UNS8 *data, UNS32 length, UNS32 *date, UNS32 *time);
 /* Loads the DCF data in the local dict for the master nodeid */
 int     ds302_load_dcf_local (CO_Data*);
-/* set the HB for a node */
+/* set the HB for a node, a zero heartbeat disables it. Starts the heartbeat statistics,
+   unless the consumer time is under DS302_HB_MIN_TICKS wheel ticks */
 int     ds302_setHeartbeat (CO_Data*, UNS8 nodeid, UNS16 heartbeat);
+/* copies the heartbeat statistics of a node, 0 if it has none (or they are being written) */
+int     ds302_hb_stats (CO_Data*, UNS8 nodeid, ds302_hbstat_t *stats);
+/* time left in us before the heartbeat consumer time elapses, from the copy. 0 if no heartbeat was seen */
+INTEGER32   ds302_hb_margin (const ds302_hbstat_t *stats);
+/* clears the heartbeat statistics of a node (done with the next heartbeat) */
+void    ds302_hb_reset (CO_Data*, UNS8 nodeid);
 
 
 // additional helper functions
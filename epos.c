@@ -5,11 +5,14 @@ epos.c
 Main routines for the EPOS drives
 */
 
+#include <stdlib.h>
+#include <string.h>
 #include "EPOScontrol.h"
 #include "dcf.h"
 #include "epos.h"
-
-#define EPOS_PDO_MAX     4
+#if defined(RTAPI)
+#include "hal.h"
+#endif
 
 epos_error_t epos_error_table[] = {
     {0x0000, "No error", "No error is present"},
@@ -64,48 +67,305 @@ const char * epos_error_text (UNS16 errCode) {
     return "(unknown)";
 }
 
-// master EPOS drive structure
-EPOS_drive_t        EPOS_drive;
+// the EPOS contexts, one per bus, each with its configuration and diagnostics
+static EPOS_drive_t _epos_ctx[EPOS_CAN_BUSES];
+
+/*
+ * Name         : epos_ctx
+ *
+ * Synopsis     : EPOS_drive_t *  epos_ctx (CO_Data * d)
+ *
+ * Arguments    : CO_Data * d : the CanFestival object
+ *
+ * Description  : returns the EPOS context of a bus. The first lookup of a new CO_Data
+ *                (epos_initialize_master) takes a free context
+ * 
+ * Returns      : EPOS_drive_t *  the context, NULL if all are taken
+ */
+EPOS_drive_t *  epos_ctx (CO_Data * d) {
+
+    int     i;
+
+    for (i = 0; i < EPOS_CAN_BUSES; i++) {
+        if (_epos_ctx[i].d == d)
+            return &_epos_ctx[i];
+        if (_epos_ctx[i].d == NULL) {
+            _epos_ctx[i].d = d;
+            return &_epos_ctx[i];
+        }
+    }
+
+    return NULL;
+}
 
 static UNS32 _statusWordCB (CO_Data * d, const indextable *idx, UNS8 bSubindex);
+static UNS32 _inputCB (CO_Data * d, const indextable *idx, UNS8 bSubindex);
+static int  _ppm_next (EPOS_drive_t * epos, int idx);
+static int  _add_slave_pdo_dcf (dcfstream_t *nodedcf, UNS8 slaveid, UNS16 param, UNS16 mapping, const UNS32 *cobs,
+    const EPOS_pdo_layout_t *layout, const EPOS_pdo_object_t *objects);
+
+/* per drive objects, each an array with one entry per drive */
+static const UNS16 _drive_objects[] = {
+    0x5040, 0x5041, 0x5060, 0x5061, 0x5064, 0x506C, 0x4062, 0x406B, 0x4071, 0x4078, 0x50B1, 0x50B2, 0x50FF };
+
+/* the command image objects, in EPOS_out_field_t order */
+static const UNS16 _out_objects[EPOS_OUT_FIELDS] = {
+    0x5040, 0x5060, 0x4062, 0x406B, 0x4078, 0x50B1, 0x50B2, 0x50FF };
+
+/* the feedback image objects, bits of EPOS_drive_can_t.rx_last */
+static const UNS16 _in_objects[] = {
+    0x5041, 0x5061, 0x5064, 0x506C, 0x4071 };
+
+/*
+    PDO mapping
+
+    The process objects are arrays in the master OD (subindex = drive + 1), each matched
+    by an object on the slave. A layout lists the objects in each PDO of a drive, in the
+    same order on both sides: master TPDO n goes to slave RPDO n, slave TPDO n to master RPDO n.
+    The default layouts are the slave PDOs set up by dcfdata.txt, the slave side is left to
+    the DCF. epos_set_pdo_map() replaces them with packed layouts built from a list of
+    objects, and the matching slave PDO configuration is then added to the slave DCF
+*/
+
+/* master -> slave objects */
+static const EPOS_pdo_object_t _tx_objects[] = {
+    {"cw",      0x5040, 0x604000, 16},  // ControlWord
+    {"mode",    0x5060, 0x606000, 8},   // ModesOfOperation
+    {"dout",    0x4078, 0x207801, 16},  // DigitalOut (Maxon)
+    {"pos",     0x4062, 0x206200, 32},  // Position Demand -> Position Setting Value (Maxon)
+    {"vel",     0x406B, 0x206B00, 32},  // Velocity Demand -> Velocity Setting Value (Maxon)
+    {"tvel",    0x50FF, 0x60FF00, 32},  // Target Velocity (PVM)
+    {"voff",    0x50B1, 0x60B100, 32},  // Velocity Offset (CSP feed forward)
+    {"toff",    0x50B2, 0x60B200, 16},  // Torque Offset (CSP feed forward)
+};
+
+/* slave -> master objects */
+static const EPOS_pdo_object_t _rx_objects[] = {
+    {"sw",      0x5041, 0x604100, 16},  // StatusWord
+    {"mode",    0x5061, 0x606100, 8},   // ModesOfOperation Display
+    {"din",     0x4071, 0x207101, 16},  // DigitalIn (Maxon)
+    {"pos",     0x5064, 0x606400, 32},  // Position Actual Value
+    {"vel",     0x506C, 0x202800, 32},  // Velocity Actual Value Averaged (Maxon)
+};
+
+#define OBJ_COUNT(table)    (sizeof(table) / sizeof(table[0]))
+
+/* default layouts, object indexes in the tables above */
+#define FRAME2(a,b)         { 2, {a,b}, {0} }
+#define FRAME3(a,b,c)       { 3, {a,b,c}, {0} }
+
+static const EPOS_pdo_layout_t _tx_default = { 3, {
+    FRAME3(0, 1, 2),    // ControlWord + ModesOfOperation + DigitalOut
+    FRAME2(0, 3),       // ControlWord + Position Demand (PPM needs both in the same PDO)
+    FRAME2(4, 5),       // Velocity Demand + Target Velocity, no handshake so no ControlWord
+} };
+
+static const EPOS_pdo_layout_t _rx_default = { 2, {
+    FRAME3(0, 1, 2),    // StatusWord + ModesOfOperation Display + DigitalIn
+    FRAME2(3, 4),       // Position Actual + Velocity Actual
+} };
+
+/* COB-ID bases, slave TPDOs (master RPDOs) and slave RPDOs (master TPDOs) */
+static const UNS32 _slave_tx_cobs[EPOS_PDO_MAX] = {0x180, 0x280, 0x380, 0x480};
+static const UNS32 _slave_rx_cobs[EPOS_PDO_MAX] = {0x200, 0x300, 0x400, 0x500};
+
+/*
+ * Name         : _od_capacity
+ *
+ * Synopsis     : static int    _od_capacity (CO_Data * d)
+ *
+ * Arguments    : CO_Data * d : the CanFestival object
+ *
+ * Description  : Finds how many drives the compiled OD has room for. Each drive needs
+ *                one entry in the drive object arrays, a client SDO and EPOS_PDO_MAX
+ *                RX/TX PDOs, each with room for EPOS_PDO_MAX_MAP objects. The OD is
+ *                sized with od_drives.py
+ * 
+ * Returns      : int    the number of drives
+ */
+static int  _od_capacity (CO_Data * d) {
+
+    int                 capacity = EPOS_MAX_SLAVES;
+    int                 i;
+    UNS32               errorCode;
+    const indextable    *object;
+
+    for (i = 0; i < sizeof(_drive_objects) / sizeof(_drive_objects[0]); i++) {
+        object = (*d->scanIndexOD)(d, _drive_objects[i], &errorCode);
+        if (errorCode != OD_SUCCESSFUL)
+            return 0;
+        // subindex 0 is the entry count
+        if (object->bSubCount - 1 < capacity)
+            capacity = object->bSubCount - 1;
+    }
+
+    for (i = 0; i < capacity; i++) {
+        (*d->scanIndexOD)(d, 0x1280 + i, &errorCode);
+        if (errorCode != OD_SUCCESSFUL)
+            break;
+        (*d->scanIndexOD)(d, 0x1400 + (i + 1) * EPOS_PDO_MAX - 1, &errorCode);
+        if (errorCode != OD_SUCCESSFUL)
+            break;
+        (*d->scanIndexOD)(d, 0x1800 + (i + 1) * EPOS_PDO_MAX - 1, &errorCode);
+        if (errorCode != OD_SUCCESSFUL)
+            break;
+        object = (*d->scanIndexOD)(d, 0x1600 + (i + 1) * EPOS_PDO_MAX - 1, &errorCode);
+        if (errorCode != OD_SUCCESSFUL || object->bSubCount - 1 < EPOS_PDO_MAX_MAP)
+            break;
+        object = (*d->scanIndexOD)(d, 0x1A00 + (i + 1) * EPOS_PDO_MAX - 1, &errorCode);
+        if (errorCode != OD_SUCCESSFUL || object->bSubCount - 1 < EPOS_PDO_MAX_MAP)
+            break;
+    }
+
+    return i;
+}
+
+/* the first entry of an OD array (subindex 1), the entries are contiguous */
+static void *   _od_array (CO_Data * d, UNS16 index) {
+
+    UNS32               errorCode;
+    const indextable    *object = (*d->scanIndexOD)(d, index, &errorCode);
+
+    if (errorCode != OD_SUCCESSFUL || object->bSubCount < 2)
+        return NULL;
+
+    return object->pSubindex[1].pObject;
+}
+
+/*
+ * Name         : _resolve_od
+ *
+ * Synopsis     : static int    _resolve_od (EPOS_drive_t * epos, CO_Data * d)
+ *
+ * Arguments    : EPOS_drive_t * epos : the EPOS context of the bus
+ *                CO_Data * d : the CanFestival object
+ *
+ * Description  : Finds the drive object arrays in the OD of the bus. Each master OD has
+ *                its own variables, so they are reached through the context, never by name
+ * 
+ * Returns      : int    0 if error (an object is missing), 1 if success
+ */
+static int  _resolve_od (EPOS_drive_t * epos, CO_Data * d) {
+
+    EPOS_od_t   *od = &epos->od;
+
+    od->ControlWord = _od_array (d, 0x5040);
+    od->StatusWord = _od_array (d, 0x5041);
+    od->OperationMode = _od_array (d, 0x5060);
+    od->OperationModeDisplay = _od_array (d, 0x5061);
+    od->PositionActualValue = _od_array (d, 0x5064);
+    od->VelocityActualValue = _od_array (d, 0x506C);
+    od->PositionDemandValue = _od_array (d, 0x4062);
+    od->VelocityDemandValue = _od_array (d, 0x406B);
+    od->DigitalIn = _od_array (d, 0x4071);
+    od->DigitalOut = _od_array (d, 0x4078);
+    od->VelocityOffset = _od_array (d, 0x50B1);
+    od->TorqueOffset = _od_array (d, 0x50B2);
+    od->TargetVelocity = _od_array (d, 0x50FF);
+
+    return od->ControlWord && od->StatusWord && od->OperationMode && od->OperationModeDisplay &&
+        od->PositionActualValue && od->VelocityActualValue && od->PositionDemandValue &&
+        od->VelocityDemandValue && od->DigitalIn && od->DigitalOut && od->VelocityOffset && od->TorqueOffset &&
+        od->TargetVelocity;
+}
+
+/*
+ * Name         : _alloc_aligned
+ *
+ * Synopsis     : static void *   _alloc_aligned (unsigned long size)
+ *
+ * Arguments    : unsigned long  size : bytes to allocate
+ *
+ * Description  : Allocates zeroed memory for the per drive data, aligned to a cache line.
+ *                Never freed, it lives as long as the module
+ * 
+ * Returns      : void *    the memory, NULL if out of memory
+ */
+static void *   _alloc_aligned (unsigned long size) {
+
+    char    *mem = EPOS_ALLOC (size + EPOS_CACHE_LINE);
+
+    if (!mem)
+        return NULL;
+
+    memset (mem, 0, size + EPOS_CACHE_LINE);
+
+    return (void *)(((unsigned long)mem + EPOS_CACHE_LINE - 1) & ~(unsigned long)(EPOS_CACHE_LINE - 1));
+}
+
+/*
+ * Name         : _alloc_drives
+ *
+ * Synopsis     : static int  _alloc_drives (EPOS_drive_t * epos, int count)
+ *
+ * Arguments    : EPOS_drive_t * epos : the EPOS context of the bus
+ *                int  count : number of drives
+ *
+ * Description  : Allocates the per drive data for count drives
+ * 
+ * Returns      : int    0 if error, 1 if success
+ */
+static int  _alloc_drives (EPOS_drive_t * epos, int count) {
+
+    epos->rt = _alloc_aligned (count * sizeof (*epos->rt));
+    epos->cmd = _alloc_aligned (count * sizeof (*epos->cmd));
+    epos->can = _alloc_aligned (count * sizeof (*epos->can));
+    epos->epos_slaves = _alloc_aligned (count * sizeof (*epos->epos_slaves));
+    epos->tx_pdo_map = _alloc_aligned (count * sizeof (*epos->tx_pdo_map));
+    epos->ppm_points = _alloc_aligned (count * sizeof (*epos->ppm_points));
+
+    epos->cold.slave_err = _alloc_aligned (count * sizeof (*epos->cold.slave_err));
+    epos->cold.profile = _alloc_aligned (count * sizeof (*epos->cold.profile));
+    epos->cold.profile_sent = _alloc_aligned (count * sizeof (*epos->cold.profile_sent));
+    epos->cold.profile_queued = _alloc_aligned (count * sizeof (*epos->cold.profile_queued));
+    epos->cold.homing_req = _alloc_aligned (count * sizeof (*epos->cold.homing_req));
+    epos->cold.homing = _alloc_aligned (count * sizeof (*epos->cold.homing));
+    epos->cold.sdos = _alloc_aligned (count * sizeof (*epos->cold.sdos));
+
+    return epos->rt && epos->cmd && epos->can && epos->epos_slaves &&
+        epos->tx_pdo_map && epos->ppm_points && epos->cold.slave_err &&
+        epos->cold.profile && epos->cold.profile_sent && epos->cold.profile_queued &&
+        epos->cold.homing_req && epos->cold.homing && epos->cold.sdos;
+}
 
 /*
  * Name         : epos_add_slave
  *
- * Synopsis     : int    epos_add_slave (UNS8 slaveid)
+ * Synopsis     : int    epos_add_slave (EPOS_drive_t * epos, UNS8 slaveid)
  *
- * Arguments    : UNS8  slaveid : slave id to add
+ * Arguments    : EPOS_drive_t * epos : the EPOS context of the bus
+ *                UNS8  slaveid : slave id to add
  *
  * Description  : Adds a new slave to the drive object
  * 
  * Returns      : int    0 if error, 1 if success
  */
-int    epos_add_slave (UNS8 slaveid) {
+int    epos_add_slave (EPOS_drive_t * epos, UNS8 slaveid) {
     
-   if (slaveid == getNodeId(EPOS_drive.d) || slaveid < 1)
+   if (slaveid == getNodeId(epos->d) || slaveid < 1)
         return 0;
     
-    if (EPOS_drive.epos_slave_count >= EPOS_MAX_DRIVES)
+    if (epos->epos_slave_count >= epos->epos_max_drives)
         return 0;
     
     // add the node to the list
-    EPOS_drive.epos_slaves[EPOS_drive.epos_slave_count] = slaveid;
+    epos->epos_slaves[epos->epos_slave_count] = slaveid;
     
     // setup the SDOs
-    if (!epos_setup_sdo (slaveid, EPOS_drive.epos_slave_count))
+    if (!epos_setup_sdo (epos, slaveid, epos->epos_slave_count))
         return 0;
     
     // setup the PDO block for the node
-    if (!epos_setup_rx_pdo (slaveid, EPOS_drive.epos_slave_count))
+    if (!epos_setup_rx_pdo (epos, slaveid, epos->epos_slave_count))
         return 0;
-    if (!epos_setup_tx_pdo (slaveid, EPOS_drive.epos_slave_count))
+    if (!epos_setup_tx_pdo (epos, slaveid, epos->epos_slave_count))
         return 0;
     
     // add the DCF data to the node
     UNS32               errorCode;
     const indextable    *Object1F22;
     
-    Object1F22 = (*EPOS_drive.d->scanIndexOD)(EPOS_drive.d, 0x1F22, &errorCode);
+    Object1F22 = (*epos->d->scanIndexOD)(epos->d, 0x1F22, &errorCode);
     if (errorCode != OD_SUCCESSFUL)
         return 0;
     
@@ -113,18 +373,25 @@ int    epos_add_slave (UNS8 slaveid) {
         return 0;
 
     dcfstream_t *nodedcf;
-    if (!get_dcf_node (&EPOS_drive.dcf_data, slaveid, &nodedcf))
+    if (!get_dcf_node (&epos->cold.dcf_data, slaveid, &nodedcf))
         return 0;
     
     Object1F22->pSubindex[slaveid].pObject = nodedcf->dcf;
     Object1F22->pSubindex[slaveid].size = nodedcf->size;
+
+    // setup the DCF PDO mappings, matching the master layouts (only for layouts set via epos_set_pdo_map)
+    if (epos->cold.pdo_slave_dcf) {
+        if (!_add_slave_pdo_dcf (nodedcf, slaveid, 0x1400, 0x1600, _slave_rx_cobs, &epos->cold.tx_layout, _tx_objects))
+            return 0;
+        if (!_add_slave_pdo_dcf (nodedcf, slaveid, 0x1800, 0x1A00, _slave_tx_cobs, &epos->cold.rx_layout, _rx_objects))
+            return 0;
+    }
     
     // add the slave to the Network List (1F81)???
     // add the slave to the heartbeat???
-    // setup the DCF PDO mappings???
     
     // node was setup
-    EPOS_drive.epos_slave_count++;
+    epos->epos_slave_count++;
     
     return 1;
 }
@@ -132,9 +399,10 @@ int    epos_add_slave (UNS8 slaveid) {
 /*
  * Name         : epos_setup_sdo
  *
- * Synopsis     : int     epos_setup_sdo (UNS8 slaveid, int idx)
+ * Synopsis     : int     epos_setup_sdo (EPOS_drive_t * epos, UNS8 slaveid, int idx)
  *
- * Arguments    : UNS8  slaveid : Slave ID
+ * Arguments    : EPOS_drive_t * epos : the EPOS context of the bus
+ *                UNS8  slaveid : Slave ID
  *                int  idx : index of the slave in the slave table (for determining the location)
  *
  * Description  : sets up the SDOs for the slave
@@ -142,7 +410,7 @@ int    epos_add_slave (UNS8 slaveid) {
  * Returns      : int     
  */
 
-int     epos_setup_sdo (UNS8 slaveid, int idx) {
+int     epos_setup_sdo (EPOS_drive_t * epos, UNS8 slaveid, int idx) {
 
     UNS32   result;
     UNS32   size;
@@ -152,21 +420,21 @@ int     epos_setup_sdo (UNS8 slaveid, int idx) {
     // transmit SDO
     COB_ID = 0x600 + slaveid;
     size = sizeof(COB_ID);
-    result = writeLocalDict (EPOS_drive.d,
+    result = writeLocalDict (epos->d,
         0x1280 + idx, 0x01, &COB_ID, &size, 0);
     if (result != OD_SUCCESSFUL)
         return 0;
 
     // receive SDO
     COB_ID = 0x580 + slaveid;
-    result = writeLocalDict (EPOS_drive.d,
+    result = writeLocalDict (epos->d,
         0x1280 + idx, 0x02, &COB_ID, &size, 0);
     if (result != OD_SUCCESSFUL)
         return 0;
     
     // node ID
     size = sizeof(slaveid);
-    result = writeLocalDict (EPOS_drive.d,
+    result = writeLocalDict (epos->d,
         0x1280 + idx, 0x03, &slaveid, &size, 0);
     if (result != OD_SUCCESSFUL)
         return 0;
@@ -174,324 +442,956 @@ int     epos_setup_sdo (UNS8 slaveid, int idx) {
     return 1;
 }
 
+/* fills in the default slave objects of a layout */
+static void _layout_slave_objects (EPOS_pdo_layout_t *layout, const EPOS_pdo_object_t *objects) {
+
+    int     frame, entry;
+
+    for (frame = 0; frame < layout->count; frame++)
+        for (entry = 0; entry < layout->frame[frame].count; entry++)
+            layout->frame[frame].slave_obj[entry] = objects[layout->frame[frame].object[entry]].slave_obj;
+}
+
 /*
- * Name         : epos_setup_rx_pdo
+ * Name         : _parse_pdo_map
  *
- * Synopsis     : int     epos_setup_rx_pdo (UNS8 slaveid, int idx)
+ * Synopsis     : static int     _parse_pdo_map (const char *map, const EPOS_pdo_object_t *objects, int objcount, EPOS_pdo_layout_t *layout)
  *
- * Arguments    : UNS8  slaveid : slave ID
- *                int  idx : index of the slave in the slave table (for determining the location)
+ * Arguments    : const char *map : the object list
+ *                const EPOS_pdo_object_t *objects : the objects for the direction
+ *                int  objcount : number of objects
+ *                EPOS_pdo_layout_t *layout : the resulting layout
  *
- * Description  : sets up the RX PDOs for the slave, and disables them
+ * Description  : parses an object list and packs it into the minimum number of PDOs.
+ *                The list is comma separated, objects joined by + stay in the same PDO
+ *                (ex. cw+pos for PPM), name=0xIIIISS maps the object to another slave
+ *                object (index, subindex). Groups are placed largest first, each in the
+ *                first PDO with room for it (first fit decreasing)
  * 
- * Returns      : int     
+ * Returns      : int    0 if error, 1 if success
  */
-int     epos_setup_rx_pdo (UNS8 slaveid, int idx) {
-    
-    int     pdonr;
+static int  _parse_pdo_map (const char *map, const EPOS_pdo_object_t *objects, int objcount, EPOS_pdo_layout_t *layout) {
 
-    UNS32   cobs[EPOS_PDO_MAX] = {0x180, 0x280, 0x380, 0x480};
-    
-    UNS32   result;
-    UNS32   COB_ID;
-    UNS32   size;
-    UNS8    trans_type = 0xFF;
-    UNS8    map_count = 0x00;
-    
-    for (pdonr = 0; pdonr < EPOS_PDO_MAX; pdonr++) {
+    EPOS_pdo_frame_t    groups[EPOS_PDO_MAX * EPOS_PDO_MAX_MAP];
+    int                 groupbytes[EPOS_PDO_MAX * EPOS_PDO_MAX_MAP];
+    int                 framebytes[EPOS_PDO_MAX];
+    int                 ngroups = 0;
+    char                buffer[256];
+    char                *item, *saveitem, *name, *savename, *value;
+    int                 i, j, frame;
 
-        // the PDO params
-        COB_ID = 0x80000000 + cobs[pdonr] + slaveid;
-        size = sizeof(COB_ID);
-        result = writeLocalDict (EPOS_drive.d,
-            0x1400 + pdonr + (idx * EPOS_PDO_MAX), 0x01, &COB_ID, &size, 0);
-        if (result != OD_SUCCESSFUL)
-            return 0;
+    if (!map || strlen(map) >= sizeof(buffer))
+        return 0;
+    strcpy (buffer, map);
 
-        size = sizeof(trans_type);
-        result = writeLocalDict (EPOS_drive.d,
-            0x1400 + pdonr + (idx * EPOS_PDO_MAX), 0x02, &trans_type, &size, 0);
-        if (result != OD_SUCCESSFUL)
+    // split in groups of objects
+    for (item = strtok_r (buffer, ",", &saveitem); item; item = strtok_r (NULL, ",", &saveitem)) {
+
+        if (ngroups >= EPOS_PDO_MAX * EPOS_PDO_MAX_MAP)
             return 0;
-        
-        // setup the PDO mapping
-        size = sizeof(map_count);
-        result = writeLocalDict (EPOS_drive.d,
-            0x1600 + pdonr + (idx * EPOS_PDO_MAX), 0x00, &map_count, &size, 0);
-        if (result != OD_SUCCESSFUL)
-            return 0;        
-    }
 
-// setup mapping for the client
+        EPOS_pdo_frame_t    *group = &groups[ngroups];
+        group->count = 0;
+        groupbytes[ngroups] = 0;
 
-// Rx PDO 1:
-// StatusWord (2B) 0x5041 / idx + 1
-// ModesOfOperationDisplay (1B) 0x5061 / idx + 1
-// DigitalInput (2B) 0x4071 / idx + 1
-    
-    UNS32   PDO_map;
-    
-    size = sizeof (PDO_map);
-    
-    PDO_map = 0x5041 << 16 | (idx + 1) << 8 | 0x10; // IDX / SubIDX / Len (bits)
-    result = writeLocalDict (EPOS_drive.d,
-        0x1600 + 0x00 + (idx * EPOS_PDO_MAX), 0x01, &PDO_map, &size, 0);
-    if (result != OD_SUCCESSFUL)
-        return 0;        
+        for (name = strtok_r (item, "+", &savename); name; name = strtok_r (NULL, "+", &savename)) {
 
-    PDO_map = 0x5061 << 16 | (idx + 1) << 8 | 0x08; // IDX / SubIDX / Len (bits)
-    result = writeLocalDict (EPOS_drive.d,
-        0x1600 + 0x00 + (idx * EPOS_PDO_MAX), 0x02, &PDO_map, &size, 0);
-    if (result != OD_SUCCESSFUL)
-        return 0;
+            while (*name == ' ')
+                name++;
 
-    PDO_map = 0x4071 << 16 | (idx + 1) << 8 | 0x10; // IDX / SubIDX / Len (bits)
-    result = writeLocalDict (EPOS_drive.d,
-        0x1600 + 0x00 + (idx * EPOS_PDO_MAX), 0x03, &PDO_map, &size, 0);
-    if (result != OD_SUCCESSFUL)
-        return 0;
+            value = strchr (name, '=');
+            if (value)
+                *value++ = 0x00;
 
-    map_count = 0x03;
-    size = sizeof(map_count);
+            for (i = 0; i < objcount; i++)
+                if (strcmp (objects[i].name, name) == 0)
+                    break;
+            if (i == objcount) {
+                EPOS_ERR ("PDO map: unknown object %s\n", name);
+                return 0;
+            }
 
-    result = writeLocalDict (EPOS_drive.d,
-        0x1600 + 0x00 + (idx * EPOS_PDO_MAX), 0x00, &map_count, &size, 0);
-    if (result != OD_SUCCESSFUL)
-        return 0;        
+            if (group->count >= EPOS_PDO_MAX_MAP)
+                return 0;
 
-// Rx PDO 2: (mode dependant)
-// Position Actual Value (4B) 0x5064 / idx + 1
-// Velocity Actual Value (4B) 0x506C / idx + 1
-    
-    size = sizeof (PDO_map);
-    
-    PDO_map = 0x5064 << 16 | (idx + 1) << 8 | 0x20; // IDX / SubIDX / Len (bits)
-    result = writeLocalDict (EPOS_drive.d,
-        0x1600 + 0x01 + (idx * EPOS_PDO_MAX), 0x01, &PDO_map, &size, 0);
-    if (result != OD_SUCCESSFUL)
-        return 0;        
+            group->object[group->count] = i;
+            group->slave_obj[group->count] = value ? strtoul (value, NULL, 0) : objects[i].slave_obj;
+            group->count++;
+            groupbytes[ngroups] += objects[i].bits / 8;
+        }
 
-    PDO_map = 0x506C << 16 | (idx + 1) << 8 | 0x08; // IDX / SubIDX / Len (bits)
-    result = writeLocalDict (EPOS_drive.d,
-        0x1600 + 0x01 + (idx * EPOS_PDO_MAX), 0x02, &PDO_map, &size, 0);
-    if (result != OD_SUCCESSFUL)
-        return 0;
+        if (groupbytes[ngroups] > 8) {
+            EPOS_ERR ("PDO map: group %d is larger than a PDO\n", ngroups);
+            return 0;
+        }
 
-    map_count = 0x02;
-    size = sizeof(map_count);
+        if (group->count > 0)
+            ngroups++;
+    }
+
+    // largest groups first (stable, so equal sizes keep the given order)
+    int     order[EPOS_PDO_MAX * EPOS_PDO_MAX_MAP];
+    for (i = 0; i < ngroups; i++) {
+        for (j = i; j > 0 && groupbytes[order[j - 1]] < groupbytes[i]; j--)
+            order[j] = order[j - 1];
+        order[j] = i;
+    }
+
+    // first fit
+    layout->count = 0;
+    for (i = 0; i < ngroups; i++) {
+        EPOS_pdo_frame_t    *group = &groups[order[i]];
+
+        for (frame = 0; frame < layout->count; frame++)
+            if (framebytes[frame] + groupbytes[order[i]] <= 8 &&
+                layout->frame[frame].count + group->count <= EPOS_PDO_MAX_MAP)
+                break;
+
+        if (frame == layout->count) {
+            if (layout->count >= EPOS_PDO_MAX) {
+                EPOS_ERR ("PDO map: more than %d PDOs needed\n", EPOS_PDO_MAX);
+                return 0;
+            }
+            layout->frame[frame].count = 0;
+            framebytes[frame] = 0;
+            layout->count++;
+        }
+
+        for (j = 0; j < group->count; j++) {
+            EPOS_pdo_frame_t    *dst = &layout->frame[frame];
+            dst->object[dst->count] = group->object[j];
+            dst->slave_obj[dst->count] = group->slave_obj[j];
+            dst->count++;
+        }
+        framebytes[frame] += groupbytes[order[i]];
+    }
 
-    result = writeLocalDict (EPOS_drive.d,
-        0x1600 + 0x01 + (idx * EPOS_PDO_MAX), 0x00, &map_count, &size, 0);
-    if (result != OD_SUCCESSFUL)
-        return 0;        
-    
     return 1;
 }
 
+/*
+ * Name         : epos_set_pdo_map
+ *
+ * Synopsis     : int     epos_set_pdo_map (EPOS_drive_t * epos, const char *tx, const char *rx)
+ *
+ * Arguments    : EPOS_drive_t * epos : the EPOS context of the bus
+ *                const char *tx : objects sent to the drives (cw, mode, dout, pos, vel)
+ *                const char *rx : objects received from the drives (sw, mode, din, pos, vel)
+ *
+ * Description  : replaces the default PDO layouts with layouts packed from the object
+ *                lists (see _parse_pdo_map). NULL keeps the default for that direction.
+ *                The slave PDO mapping is added to the slave DCF by epos_add_slave, so this
+ *                must be called after epos_initialize_master and before adding the slaves
+ * 
+ * Returns      : int    0 if error, 1 if success
+ */
+int     epos_set_pdo_map (EPOS_drive_t * epos, const char *tx, const char *rx) {
+
+    if (tx) {
+        if (!_parse_pdo_map (tx, _tx_objects, OBJ_COUNT(_tx_objects), &epos->cold.tx_layout))
+            return 0;
+        epos->cold.pdo_slave_dcf = 1;
+    }
+
+    if (rx) {
+        if (!_parse_pdo_map (rx, _rx_objects, OBJ_COUNT(_rx_objects), &epos->cold.rx_layout))
+            return 0;
+        epos->cold.pdo_slave_dcf = 1;
+    }
+
+    return 1;
+}
 
 /*
- * Name         : epos_setup_tx_pdo
+ * Name         : _setup_pdo
  *
- * Synopsis     : int     epos_setup_tx_pdo (UNS8 slaveid, int idx)
+ * Synopsis     : static int     _setup_pdo (EPOS_drive_t * epos, UNS8 slaveid, int idx, UNS16 param, UNS16 mapping, const UNS32 *cobs, UNS32 enable, const EPOS_pdo_layout_t *layout, const EPOS_pdo_object_t *objects)
  *
- * Arguments    : UNS8  slaveid : slave ID
+ * Arguments    : EPOS_drive_t * epos : the EPOS context of the bus
+ *                UNS8  slaveid : slave ID
  *                int  idx : index of the slave in the slave table (for determining the location)
+ *                UNS16  param, mapping : the PDO communication / mapping parameter base (0x1400/0x1600, 0x1800/0x1A00)
+ *                const UNS32 *cobs : the COB-ID base for each PDO
+ *                UNS32  enable : 0 to enable the PDOs in the layout, 0x80000000 to keep them disabled
+ *                const EPOS_pdo_layout_t *layout : the PDO layout
+ *                const EPOS_pdo_object_t *objects : the objects for the direction
  *
- * Description  : sets up the TX PDOs for the slave, and disables them
+ * Description  : sets up the master PDOs of a drive from the layout. Unused PDOs are disabled
  * 
- * Returns      : int     
+ * Returns      : int     0 if error, 1 if success
  */
+static int  _setup_pdo (EPOS_drive_t * epos, UNS8 slaveid, int idx, UNS16 param, UNS16 mapping, const UNS32 *cobs, UNS32 enable,
+    const EPOS_pdo_layout_t *layout, const EPOS_pdo_object_t *objects) {
 
-int     epos_setup_tx_pdo (UNS8 slaveid, int idx) {
-    
-    int     pdonr;
-
-    UNS32   cobs[EPOS_PDO_MAX] = {0x200, 0x300, 0x400, 0x500};
-    
+    int     pdonr, entry;
+    UNS16   pdo;
     UNS32   result;
     UNS32   COB_ID;
+    UNS32   PDO_map;
     UNS32   size;
     UNS8    trans_type = 0xFF;
-    UNS8    map_count = 0x00;
-    UNS16   inhibit_time = 0; //10; //(it's in 100us, 10 = 1ms)
-    
+    UNS8    map_count;
+
     for (pdonr = 0; pdonr < EPOS_PDO_MAX; pdonr++) {
 
-        // the PDO params
-        if (pdonr < 2)
-            COB_ID = 0x00000000 + cobs[pdonr] + slaveid;
-        else
-            COB_ID = 0x80000000 + cobs[pdonr] + slaveid;
+        pdo = pdonr + (idx * EPOS_PDO_MAX);
+
+        // the PDO params, disabled while mapping
+        COB_ID = 0x80000000 + cobs[pdonr] + slaveid;
         size = sizeof(COB_ID);
-        result = writeLocalDict (EPOS_drive.d,
-            0x1800 + pdonr + (idx * EPOS_PDO_MAX), 0x01, &COB_ID, &size, 0);
+        result = writeLocalDict (epos->d,
+            param + pdo, 0x01, &COB_ID, &size, 0);
         if (result != OD_SUCCESSFUL)
             return 0;
 
         size = sizeof(trans_type);
-        result = writeLocalDict (EPOS_drive.d,
-            0x1800 + pdonr + (idx * EPOS_PDO_MAX), 0x02, &trans_type, &size, 0);
-        if (result != OD_SUCCESSFUL)
-            return 0;
-        
-        size = sizeof(inhibit_time);
-        result = writeLocalDict (EPOS_drive.d,
-            0x1800 + pdonr + (idx * EPOS_PDO_MAX), 0x03, &inhibit_time, &size, 0);
+        result = writeLocalDict (epos->d,
+            param + pdo, 0x02, &trans_type, &size, 0);
         if (result != OD_SUCCESSFUL)
             return 0;
-                
+
         // setup the PDO mapping
+        map_count = 0x00;
         size = sizeof(map_count);
-        result = writeLocalDict (EPOS_drive.d,
-            0x1A00 + pdonr + (idx * EPOS_PDO_MAX), 0x00, &map_count, &size, 0);
+        result = writeLocalDict (epos->d,
+            mapping + pdo, 0x00, &map_count, &size, 0);
         if (result != OD_SUCCESSFUL)
             return 0;        
-    }
-    
-// setup mapping for the client
-
-// Tx PDO 1:
-// ControlWord (2B) 0x5040 / idx + 1
-// ModesOfOperation (1B) 0x5060 / idx + 1
-// DigitalOutput (2B) 0x4078 / idx + 1
-
-    UNS32   PDO_map;
-    
-    size = sizeof (PDO_map);
-
-    PDO_map = 0x5040 << 16 | (idx + 1) << 8 | 0x10; // IDX / SubIDX / Len (bits)
-    result = writeLocalDict (EPOS_drive.d,
-        0x1A00 + 0x00 + (idx * EPOS_PDO_MAX), 0x01, &PDO_map, &size, 0);
-    if (result != OD_SUCCESSFUL)
-        return 0;        
-    
-    PDO_map = 0x5060 << 16 | (idx + 1) << 8 | 0x08; // IDX / SubIDX / Len (bits)
-    result = writeLocalDict (EPOS_drive.d,
-        0x1A00 + 0x00 + (idx * EPOS_PDO_MAX), 0x02, &PDO_map, &size, 0);
-    if (result != OD_SUCCESSFUL)
-        return 0;        
 
-    PDO_map = 0x4078 << 16 | (idx + 1) << 8 | 0x10; // IDX / SubIDX / Len (bits)
-    result = writeLocalDict (EPOS_drive.d,
-        0x1A00 + 0x00 + (idx * EPOS_PDO_MAX), 0x03, &PDO_map, &size, 0);
-    if (result != OD_SUCCESSFUL)
-        return 0;        
+        if (pdonr >= layout->count)
+            continue;
 
-    map_count = 0x03;
-    size = sizeof(map_count);
-    result = writeLocalDict (EPOS_drive.d,
-        0x1A00 + 0x00 + (idx * EPOS_PDO_MAX), 0x00, &map_count, &size, 0);
-    if (result != OD_SUCCESSFUL)
-        return 0;        
+        const EPOS_pdo_frame_t  *frame = &layout->frame[pdonr];
 
-// Tx PDO 2: (mode dependant)
-// PPM: ControlWord + Position Demand
-// ControlWord (2B) 0x5040 / idx + 1
-// Position Demand Value (4B) 0x4062 / idx + 1
-// VPM: ControlWord + Velocity Demand
+        size = sizeof (PDO_map);
+        for (entry = 0; entry < frame->count; entry++) {
+            const EPOS_pdo_object_t *object = &objects[frame->object[entry]];
 
-    size = sizeof (PDO_map);
+            PDO_map = object->master_idx << 16 | (idx + 1) << 8 | object->bits; // IDX / SubIDX / Len (bits)
+            result = writeLocalDict (epos->d,
+                mapping + pdo, 0x01 + entry, &PDO_map, &size, 0);
+            if (result != OD_SUCCESSFUL)
+                return 0;
+        }
 
-    PDO_map = 0x5040 << 16 | (idx + 1) << 8 | 0x10; // IDX / SubIDX / Len (bits)
-    result = writeLocalDict (EPOS_drive.d,
-        0x1A00 + 0x01 + (idx * EPOS_PDO_MAX), 0x01, &PDO_map, &size, 0);
-    if (result != OD_SUCCESSFUL)
-        return 0;        
+        map_count = frame->count;
+        size = sizeof(map_count);
+        result = writeLocalDict (epos->d,
+            mapping + pdo, 0x00, &map_count, &size, 0);
+        if (result != OD_SUCCESSFUL)
+            return 0;        
 
-    PDO_map = 0x4062 << 16 | (idx + 1) << 8 | 0x20; // IDX / SubIDX / Len (bits)
-    result = writeLocalDict (EPOS_drive.d,
-        0x1A00 + 0x01 + (idx * EPOS_PDO_MAX), 0x02, &PDO_map, &size, 0);
-    if (result != OD_SUCCESSFUL)
-        return 0;        
+        COB_ID = enable + cobs[pdonr] + slaveid;
+        size = sizeof(COB_ID);
+        result = writeLocalDict (epos->d,
+            param + pdo, 0x01, &COB_ID, &size, 0);
+        if (result != OD_SUCCESSFUL)
+            return 0;
+    }
 
-    map_count = 0x02;
-    size = sizeof(map_count);
-    result = writeLocalDict (EPOS_drive.d,
-        0x1A00 + 0x01 + (idx * EPOS_PDO_MAX), 0x00, &map_count, &size, 0);
-    if (result != OD_SUCCESSFUL)
-        return 0;        
-    
     return 1;
 }
 
 /*
- * Name         : epos_setup_master
+ * Name         : _add_slave_pdo_dcf
  *
- * Synopsis     : int     epos_setup_master ()
+ * Synopsis     : static int     _add_slave_pdo_dcf (dcfstream_t *nodedcf, UNS8 slaveid, UNS16 param, UNS16 mapping, const UNS32 *cobs, const EPOS_pdo_layout_t *layout, const EPOS_pdo_object_t *objects)
  *
- * Description  : set ups the master
+ * Arguments    : dcfstream_t *nodedcf : the slave DCF
+ *                UNS8  slaveid : slave ID
+ *                UNS16  param, mapping : the slave PDO communication / mapping parameter base
+ *                const UNS32 *cobs : the COB-ID base for each PDO
+ *                const EPOS_pdo_layout_t *layout : the PDO layout
+ *                const EPOS_pdo_object_t *objects : the objects for the direction
+ *
+ * Description  : adds the slave side of a layout to the slave DCF, per CiA 301: disable the PDO,
+ *                clear the mapping, map the objects, set the count, enable the PDO.
+ *                The transmission type is left to the DCF
  * 
- * Returns      : int     
+ * Returns      : int     0 if error, 1 if success
  */
+static int  _add_slave_pdo_dcf (dcfstream_t *nodedcf, UNS8 slaveid, UNS16 param, UNS16 mapping, const UNS32 *cobs,
+    const EPOS_pdo_layout_t *layout, const EPOS_pdo_object_t *objects) {
 
-int     epos_initialize_master (CO_Data * d, const char * dcf_file) {
-    
-    int idx;
-    
-    EPOS_drive.epos_slave_count = 0;
-    EPOS_drive.d = d;
-    
-    clear_dcf_set (&EPOS_drive.dcf_data);
-    
-    for (idx = 0; idx < EPOS_MAX_DRIVES; idx++) {
-        // clean the slaves
-        EPOS_drive.epos_slaves[idx] = 0x00;
-        
-        // clean the error data
-        EPOS_drive.slave_err[idx][0] = 0x00;
+    int     pdonr, entry;
+    UNS32   COB_ID;
+    UNS32   PDO_map;
+    UNS8    map_count;
 
-        // set the callbacks
-        
-        // callback for drive status word
-        RegisterSetODentryCallBack (EPOS_drive.d, 0x5041, 0x01 + idx, _statusWordCB);
-    }
-    
-    load_dcf_set (&EPOS_drive.dcf_data, dcf_file);
-    
-    /* stupid fix for the PDO not being disabled by the objdictedit generator */
-    
-    UNS32   COB_ID = 0x80000000;
-    UNS32   size = sizeof (COB_ID);
+    for (pdonr = 0; pdonr < EPOS_PDO_MAX; pdonr++) {
 
-    for (idx = 0; idx < 20; idx++) {
-        writeLocalDict (EPOS_drive.d,
-            0x1400 + idx, 0x01, &COB_ID, &size, 0);
-        
-        writeLocalDict (EPOS_drive.d,
-            0x1800 + idx, 0x01, &COB_ID, &size, 0);
+        COB_ID = 0x80000000 + cobs[pdonr] + slaveid;
+        if (!add_dcf_entry (nodedcf, param + pdonr, 0x01, sizeof(COB_ID), &COB_ID))
+            return 0;
+
+        map_count = 0x00;
+        if (!add_dcf_entry (nodedcf, mapping + pdonr, 0x00, sizeof(map_count), &map_count))
+            return 0;
+
+        if (pdonr >= layout->count)
+            continue;
+
+        const EPOS_pdo_frame_t  *frame = &layout->frame[pdonr];
+
+        for (entry = 0; entry < frame->count; entry++) {
+            PDO_map = frame->slave_obj[entry] << 8 | objects[frame->object[entry]].bits; // IDX / SubIDX / Len (bits)
+            if (!add_dcf_entry (nodedcf, mapping + pdonr, 0x01 + entry, sizeof(PDO_map), &PDO_map))
+                return 0;
+        }
+
+        map_count = frame->count;
+        if (!add_dcf_entry (nodedcf, mapping + pdonr, 0x00, sizeof(map_count), &map_count))
+            return 0;
+
+        COB_ID = cobs[pdonr] + slaveid;
+        if (!add_dcf_entry (nodedcf, param + pdonr, 0x01, sizeof(COB_ID), &COB_ID))
+            return 0;
     }
 
-    // clear the SDO data
-    
     return 1;
 }
 
 /*
- * Name         : epos_get_slave_index
+ * Name         : epos_setup_rx_pdo
  *
- * Synopsis     : int     epos_get_slave_index (UNS8 slaveid)
+ * Synopsis     : int     epos_setup_rx_pdo (EPOS_drive_t * epos, UNS8 slaveid, int idx)
  *
- * Arguments    : UNS8  slaveid : Slave ID
+ * Arguments    : EPOS_drive_t * epos : the EPOS context of the bus
+ *                UNS8  slaveid : slave ID
+ *                int  idx : index of the slave in the slave table (for determining the location)
  *
- * Description  : returns the slave index for the provided ID
+ * Description  : sets up the RX PDOs for the slave from the RX layout, and disables them
  * 
  * Returns      : int     
  */
+int     epos_setup_rx_pdo (EPOS_drive_t * epos, UNS8 slaveid, int idx) {
 
-int     epos_get_slave_index (UNS8 slaveid) {
-    
-    int idx;
-    for (idx = 0; idx < EPOS_drive.epos_slave_count; idx++)
-        if (EPOS_drive.epos_slaves[idx] == slaveid)
-            return idx;
-        
-    return -1;
+    if (!_setup_pdo (epos, slaveid, idx, 0x1400, 0x1600, _slave_tx_cobs, 0x80000000,
+        &epos->cold.rx_layout, _rx_objects))
+        return 0;
+
+    return epos_map_rx_pdo (epos, idx);
 }
 
+/* 1 if the PDO with the communication parameter param (0x1800 + n) is enabled */
+static int  _pdo_enabled (CO_Data * d, UNS16 param) {
+
+    UNS32               errorCode;
+    const indextable    *comm = (*d->scanIndexOD)(d, param, &errorCode);
+
+    if (errorCode != OD_SUCCESSFUL || comm->bSubCount < 2)
+        return 0;
 
+    // COB-ID bit 31 set, the PDO does not exist
+    return !(*(UNS32 *)comm->pSubindex[1].pObject & 0x80000000);
+}
 
 /*
- * the status word callback does the state machines for the DS402
+ * Name         : epos_map_rx_pdo
+ *
+ * Synopsis     : int     epos_map_rx_pdo (EPOS_drive_t * epos, int idx)
+ *
+ * Arguments    : EPOS_drive_t * epos : the EPOS context of the bus
+ *                int  idx : index of the slave in the slave table
+ *
+ * Description  : finds the last feedback object of the drive in each RPDO mapping present
+ *                in the OD. CanFestival writes the mapped objects in order, so the input image
+ *                is published once per RPDO, from the callback of that object.
+ *                Needs to be called again if the master mapping is changed (local DCF)
+ * 
+ * Returns      : int    0 if error, 1 if success
+ */
+int     epos_map_rx_pdo (EPOS_drive_t * epos, int idx) {
+
+    UNS32               errorCode;
+    const indextable    *map;
+    int                 pdonr, entry, object;
+    UNS8                rx_last = 0;
+
+    for (pdonr = 0; pdonr < 0x200; pdonr++) {
+        map = (*epos->d->scanIndexOD)(epos->d, 0x1600 + pdonr, &errorCode);
+        if (errorCode != OD_SUCCESSFUL)
+            break;
+
+        UNS8    map_count = *(UNS8 *)map->pSubindex[0].pObject;
+        int     last = -1;
+
+        for (entry = 1; entry <= map_count && entry < map->bSubCount; entry++) {
+            UNS32   PDO_map = *(UNS32 *)map->pSubindex[entry].pObject;
+
+            // IDX / SubIDX / Len (bits)
+            if (((PDO_map >> 8) & 0xFF) != idx + 1)
+                continue;
+
+            for (object = 0; object < OBJ_COUNT(_in_objects); object++)
+                if ((PDO_map >> 16) == _in_objects[object])
+                    last = object;
+        }
+
+        if (last >= 0)
+            rx_last |= 1 << last;
+    }
+
+    epos->can[idx].rx_last = rx_last;
+
+    return 1;
+}
+
+
+/*
+ * Name         : epos_setup_tx_pdo
+ *
+ * Synopsis     : int     epos_setup_tx_pdo (EPOS_drive_t * epos, UNS8 slaveid, int idx)
+ *
+ * Arguments    : EPOS_drive_t * epos : the EPOS context of the bus
+ *                UNS8  slaveid : slave ID
+ *                int  idx : index of the slave in the slave table (for determining the location)
+ *
+ * Description  : sets up the TX PDOs for the slave from the TX layout, enabling the ones used
+ * 
+ * Returns      : int     
+ */
+
+int     epos_setup_tx_pdo (EPOS_drive_t * epos, UNS8 slaveid, int idx) {
+
+    int     pdonr;
+    UNS32   result;
+    UNS32   size;
+    UNS16   inhibit_time = 0; //10; //(it's in 100us, 10 = 1ms)
+
+    if (!_setup_pdo (epos, slaveid, idx, 0x1800, 0x1A00, _slave_rx_cobs, 0x00000000,
+        &epos->cold.tx_layout, _tx_objects))
+        return 0;
+
+    for (pdonr = 0; pdonr < EPOS_PDO_MAX; pdonr++) {
+        size = sizeof(inhibit_time);
+        result = writeLocalDict (epos->d,
+            0x1800 + pdonr + (idx * EPOS_PDO_MAX), 0x03, &inhibit_time, &size, 0);
+        if (result != OD_SUCCESSFUL)
+            return 0;
+    }
+
+    return epos_map_tx_pdo (epos, idx);
+}
+
+/*
+ * Name         : epos_map_tx_pdo
+ *
+ * Synopsis     : int     epos_map_tx_pdo (EPOS_drive_t * epos, int idx)
+ *
+ * Arguments    : EPOS_drive_t * epos : the EPOS context of the bus
+ *                int  idx : index of the slave in the slave table
+ *
+ * Description  : builds the reverse PDO map for the drive (command image field -> TPDOs)
+ *                from the enabled TPDO mappings present in the OD. Needs to be called again if
+ *                the master mapping is changed after epos_setup_tx_pdo (local DCF)
+ * 
+ * Returns      : int    0 if error (too many TPDOs for a field, or a TPDO CanFestival can not
+ *                         send on its own), 1 if success
+ */
+int     epos_map_tx_pdo (EPOS_drive_t * epos, int idx) {
+
+    UNS32               errorCode;
+    const indextable    *map;
+    int                 pdonr, entry, field;
+
+    for (field = 0; field < EPOS_OUT_FIELDS; field++)
+        epos->tx_pdo_map[idx][field].count = 0;
+
+    for (pdonr = 0; pdonr < 0x200; pdonr++) {
+        map = (*epos->d->scanIndexOD)(epos->d, 0x1A00 + pdonr, &errorCode);
+        if (errorCode != OD_SUCCESSFUL)
+            break;
+        if (!_pdo_enabled (epos->d, 0x1800 + pdonr))
+            continue;
+
+        UNS8    map_count = *(UNS8 *)map->pSubindex[0].pObject;
+
+        for (entry = 1; entry <= map_count && entry < map->bSubCount; entry++) {
+            UNS32   PDO_map = *(UNS32 *)map->pSubindex[entry].pObject;
+
+            // IDX / SubIDX / Len (bits)
+            if (((PDO_map >> 8) & 0xFF) != idx + 1)
+                continue;
+
+            for (field = 0; field < EPOS_OUT_FIELDS; field++) {
+                EPOS_pdo_list_t *list = &epos->tx_pdo_map[idx][field];
+
+                if ((PDO_map >> 16) != _out_objects[field])
+                    continue;
+                if (list->count > 0 && list->pdo[list->count - 1] == pdonr)
+                    continue;
+                if (list->count >= EPOS_TPDO_MAP_MAX) {
+                    EPOS_ERR ("EPOS: drive %d output %d in more than %d TPDOs\n", idx, field, EPOS_TPDO_MAP_MAX);
+                    return 0;
+                }
+                // sendOnePDOevent takes an UNS8 PDO number
+                if (pdonr > 0xFF) {
+                    EPOS_ERR ("EPOS: drive %d output %d in TPDO %d, only the first 256 can be sent\n", idx, field, pdonr);
+                    return 0;
+                }
+                list->pdo[list->count++] = pdonr;
+            }
+        }
+    }
+
+    // first send after a (re)mapping sends everything
+    epos->can[idx].tx_force = 1;
+
+    return 1;
+}
+
+/*
+ * Name         : epos_set_interpolation_period
+ *
+ * Synopsis     : int     epos_set_interpolation_period (EPOS_drive_t * epos, UNS8 slaveid, UNS32 period_us)
+ *
+ * Arguments    : EPOS_drive_t * epos : the EPOS context of the bus
+ *                UNS8  slaveid : slave ID
+ *                UNS32  period_us : the SYNC / servo period in us
+ *
+ * Description  : adds the interpolation time period (0x60C2) to the slave DCF, so it's
+ *                loaded at boot. Used by the cyclic synchronous modes (CSP).
+ *                The period is stored as value * 10^index seconds
+ * 
+ * Returns      : int    0 if error, 1 if success
+ */
+int     epos_set_interpolation_period (EPOS_drive_t * epos, UNS8 slaveid, UNS32 period_us) {
+
+    dcfstream_t *nodedcf;
+    UNS8        value;
+    INTEGER8    index;
+
+    if (period_us == 0)
+        return 0;
+
+    // pick the largest unit that still represents the period exactly
+    if (period_us % 1000 == 0 && period_us / 1000 <= 0xFF) {
+        value = period_us / 1000;
+        index = -3;
+    } else if (period_us % 100 == 0 && period_us / 100 <= 0xFF) {
+        value = period_us / 100;
+        index = -4;
+    } else if (period_us <= 0xFF) {
+        value = period_us;
+        index = -6;
+    } else
+        return 0;
+
+    if (!get_dcf_node (&epos->cold.dcf_data, slaveid, &nodedcf))
+        return 0;
+
+    if (!add_dcf_entry (nodedcf, 0x60C2, 0x01, sizeof(value), &value))
+        return 0;
+    if (!add_dcf_entry (nodedcf, 0x60C2, 0x02, sizeof(index), &index))
+        return 0;
+
+    return 1;
+}
+
+/*
+ * Name         : epos_initialize_master
+ *
+ * Synopsis     : EPOS_drive_t *  epos_initialize_master (CO_Data * d, const char * dcf_file, int drives)
+ *
+ * Arguments    : CO_Data * d : the CanFestival object
+ *                const char * dcf_file : the DCF file to load
+ *                int  drives : number of drives, the per drive data is allocated for them
+ *
+ * Description  : set ups the master of a bus, the EPOS context of d is claimed here
+ * 
+ * Returns      : EPOS_drive_t *  the EPOS context, NULL if error (the OD has no room for the drives,
+ *                                 no context left, out of memory)
+ */
+
+EPOS_drive_t *  epos_initialize_master (CO_Data * d, const char * dcf_file, int drives) {
+    
+    int idx;
+    int capacity = _od_capacity (d);
+    EPOS_drive_t    *epos = epos_ctx (d);
+
+    if (!epos) {
+        EPOS_ERR ("EPOS: no context left, EPOS_CAN_BUSES is %d\n", EPOS_CAN_BUSES);
+        return NULL;
+    }
+
+    if (drives < 1 || drives > capacity) {
+        EPOS_ERR ("EPOS: %d drives requested, the OD has room for %d\n", drives, capacity);
+        return NULL;
+    }
+
+    if (!_resolve_od (epos, d)) {
+        EPOS_ERR ("EPOS: the OD misses the drive objects\n");
+        return NULL;
+    }
+
+    if (!_alloc_drives (epos, drives)) {
+        EPOS_ERR ("EPOS: out of memory for %d drives\n", drives);
+        return NULL;
+    }
+
+    epos->epos_slave_count = 0;
+    epos->d = d;
+    epos->cw_deferred = 0;
+    epos->ppm_depth = 0;
+    epos->ppm_buffered = 0;
+    for (idx = 0; idx < drives; idx++)
+        epos->rt[idx].hmm_state = HMM_Idle;
+
+    // default PDO layouts
+    epos->cold.tx_layout = _tx_default;
+    _layout_slave_objects (&epos->cold.tx_layout, _tx_objects);
+    epos->cold.rx_layout = _rx_default;
+    _layout_slave_objects (&epos->cold.rx_layout, _rx_objects);
+    epos->cold.pdo_slave_dcf = 0;
+    epos->epos_max_drives = drives;
+    
+    clear_dcf_set (&epos->cold.dcf_data);
+    
+    for (idx = 0; idx < epos->epos_max_drives; idx++) {
+        // clean the slaves
+        epos->epos_slaves[idx] = 0x00;
+        
+        // clean the error data
+        epos->cold.slave_err[idx][0] = 0x00;
+
+        // set the callbacks
+        
+        // callback for drive status word
+        RegisterSetODentryCallBack (epos->d, 0x5041, 0x01 + idx, _statusWordCB);
+
+        // callbacks for the rest of the feedback, keeping the input image up to date
+        RegisterSetODentryCallBack (epos->d, 0x5061, 0x01 + idx, _inputCB);
+        RegisterSetODentryCallBack (epos->d, 0x5064, 0x01 + idx, _inputCB);
+        RegisterSetODentryCallBack (epos->d, 0x506C, 0x01 + idx, _inputCB);
+        RegisterSetODentryCallBack (epos->d, 0x4071, 0x01 + idx, _inputCB);
+    }
+    
+    load_dcf_set (&epos->cold.dcf_data, dcf_file);
+    
+    /* stupid fix for the PDO not being disabled by the objdictedit generator */
+    
+    UNS32   COB_ID = 0x80000000;
+    UNS32   size = sizeof (COB_ID);
+
+    // all the PDOs the OD has, not just the ones used by the drives
+    for (idx = 0; idx < 0x200; idx++) {
+        if (writeLocalDict (epos->d,
+            0x1400 + idx, 0x01, &COB_ID, &size, 0) != OD_SUCCESSFUL)
+            break;
+    }
+
+    for (idx = 0; idx < 0x200; idx++) {
+        if (writeLocalDict (epos->d,
+            0x1800 + idx, 0x01, &COB_ID, &size, 0) != OD_SUCCESSFUL)
+            break;
+    }
+
+    // clear the SDO data
+    for (idx = 0; idx < drives; idx++) {
+        epos->cold.sdos[idx].state = SDO_BATCH_IDLE;
+        _init_sdo_transfer (epos, idx);
+    }
+    epos->cold.sdo_ring.head = 0;
+    epos->cold.sdo_ring.tail = 0;
+    memset (epos->cold.profile_sent, 0, drives * sizeof (*epos->cold.profile_sent));
+    
+    return epos;
+}
+
+/*
+ * Name         : epos_get_slave_index
+ *
+ * Synopsis     : int     epos_get_slave_index (EPOS_drive_t * epos, UNS8 slaveid)
+ *
+ * Arguments    : EPOS_drive_t * epos : the EPOS context of the bus
+ *                UNS8  slaveid : Slave ID
+ *
+ * Description  : returns the slave index for the provided ID
+ * 
+ * Returns      : int     
+ */
+
+int     epos_get_slave_index (EPOS_drive_t * epos, UNS8 slaveid) {
+    
+    int idx;
+    for (idx = 0; idx < epos->epos_slave_count; idx++)
+        if (epos->epos_slaves[idx] == slaveid)
+            return idx;
+        
+    return -1;
+}
+
+
+
+/*
+ * Name         : epos_read_inputs
+ *
+ * Synopsis     : void    epos_read_inputs (EPOS_drive_t * epos, int idx)
+ *
+ * Arguments    : EPOS_drive_t * epos : the EPOS context of the bus
+ *                int  idx : index of the slave in the slave table
+ *
+ * Description  : RT side, start of cycle. Takes a consistent snapshot of the drive feedback
+ *                and merges the ControlWord transitions requested by the status word callback
+ *                into the command image
+ * 
+ * Returns      : void
+ */
+void    epos_read_inputs (EPOS_drive_t * epos, int idx) {
+
+    // the feedback as published by the PDO callbacks
+    DBUF_READ (epos->can[idx].in_shared, epos->rt[idx].in);
+
+    // the drive state as seen by this cycle
+    epos->rt[idx].EPOS_State = epos->rt[idx].in.StatusWord & 0x417F;
+
+    // merge the requested ControlWord transitions
+    UNS32   req = epos->can[idx].cw_request;
+
+    epos->rt[idx].out.ControlWord = (epos->rt[idx].out.ControlWord & ~CW_REQ_CLEAR(req)) | CW_REQ_SET(req);
+    epos->rt[idx].cw_merged = req;
+}
+
+/*
+ * Name         : epos_publish_outputs
+ *
+ * Synopsis     : void    epos_publish_outputs (EPOS_drive_t * epos, int idx)
+ *
+ * Arguments    : EPOS_drive_t * epos : the EPOS context of the bus
+ *                int  idx : index of the slave in the slave table
+ *
+ * Description  : RT side, end of cycle. Publishes the command image built during the cycle
+ * 
+ * Returns      : void
+ */
+void    epos_publish_outputs (EPOS_drive_t * epos, int idx) {
+
+    DBUF_WRITE (epos->cmd[idx].out_shared, epos->rt[idx].out);
+
+    // the merged requests are part of the published image now, drop them from the mailbox
+    // requests posted since epos_read_inputs stay for the next cycle
+    __sync_fetch_and_and (&epos->can[idx].cw_request, ~epos->rt[idx].cw_merged);
+    epos->rt[idx].cw_merged = 0;
+}
+
+/*
+ * Name         : epos_load_outputs
+ *
+ * Synopsis     : void    epos_load_outputs (EPOS_drive_t * epos, int idx)
+ *
+ * Arguments    : EPOS_drive_t * epos : the EPOS context of the bus
+ *                int  idx : index of the slave in the slave table
+ *
+ * Description  : CAN side, mutex held. Loads the last published command image into the OD,
+ *                with the requests not yet merged by update() applied on top. In PPM with the
+ *                set-point queue on, the position is the queued set-point being handed out
+ * 
+ * Returns      : UNS8    the fields that changed in the OD (1 << EPOS_out_field_t)
+ */
+#define LOAD_FIELD(OBJ,VALUE,FIELD) if (OBJ[idx] != (VALUE)) { OBJ[idx] = (VALUE); changed |= 1 << (FIELD); }
+
+UNS8    epos_load_outputs (EPOS_drive_t * epos, int idx) {
+
+    EPOS_out_image_t    image;
+    UNS8                changed = 0;
+
+    // requests first. If update() drops them from the mailbox meanwhile, the image read below has them
+    UNS32   req = epos->can[idx].cw_request;
+    __sync_synchronize();
+
+    DBUF_READ (epos->cmd[idx].out_shared, image);
+
+    // queued PPM set-points are handed out by the CAN side, along with the New set-point bit
+    INTEGER32   position = image.PositionDemandValue;
+    if (epos->ppm_depth > 0 && image.OperationMode == EPOS_MODE_PPM) {
+        if (_ppm_next (epos, idx))
+            req = (req & ~((UNS32)(1 << 4) << 16)) | (1 << 4);
+        position = epos->can[idx].ppm_target;
+    }
+
+    LOAD_FIELD (epos->od.ControlWord, (image.ControlWord & ~CW_REQ_CLEAR(req)) | CW_REQ_SET(req), EPOS_OUT_CW);
+    LOAD_FIELD (epos->od.OperationMode, image.OperationMode, EPOS_OUT_MODE);
+    LOAD_FIELD (epos->od.PositionDemandValue, position, EPOS_OUT_POS);
+    LOAD_FIELD (epos->od.VelocityDemandValue, image.VelocityDemandValue, EPOS_OUT_VEL);
+    LOAD_FIELD (epos->od.DigitalOut, image.DigitalOut, EPOS_OUT_DOUT);
+    LOAD_FIELD (epos->od.VelocityOffset, image.VelocityOffset, EPOS_OUT_VOFF);
+    LOAD_FIELD (epos->od.TorqueOffset, image.TorqueOffset, EPOS_OUT_TOFF);
+    LOAD_FIELD (epos->od.TargetVelocity, image.TargetVelocity, EPOS_OUT_TVEL);
+
+    // homing start bit cleared, wait for a new start
+    if (!BIT_IS_SET(epos->od.ControlWord[idx], 4))
+        epos->can[idx].hmm_started = 0;
+
+    return changed;
+}
+
+/* adds a PDO number to a send list, once */
+static void _add_pdo (UNS16 *list, int *count, UNS16 pdonr) {
+
+    int i;
+    for (i = 0; i < *count; i++)
+        if (list[i] == pdonr)
+            return;
+    list[(*count)++] = pdonr;
+}
+
+/*
+ * Name         : epos_send_drive_outputs
+ *
+ * Synopsis     : void    epos_send_drive_outputs (EPOS_drive_t * epos, int idx)
+ *
+ * Arguments    : EPOS_drive_t * epos : the EPOS context of the bus
+ *                int  idx : index of the slave in the slave table
+ *
+ * Description  : CAN side, mutex held. Loads the command image of the drive and sends only
+ *                the TPDOs carrying the fields that changed. A ControlWord change rides along
+ *                in a PDO that is sent anyway, otherwise only the first PDO carrying it is sent
+ * 
+ * Returns      : void
+ */
+void    epos_send_drive_outputs (EPOS_drive_t * epos, int idx) {
+
+    UNS16   list[EPOS_OUT_FIELDS * EPOS_TPDO_MAP_MAX];
+    int     count = 0;
+    int     field, i;
+
+    UNS8    changed = epos_load_outputs (epos, idx);
+
+    if (epos->can[idx].tx_force) {
+        changed = EPOS_OUT_ALL;
+        epos->can[idx].tx_force = 0;
+    }
+
+    if (!changed)
+        return;
+
+    EPOS_pdo_list_t *cw = &epos->tx_pdo_map[idx][EPOS_OUT_CW];
+
+    for (field = 0; field < EPOS_OUT_FIELDS; field++) {
+        EPOS_pdo_list_t *pdos = &epos->tx_pdo_map[idx][field];
+
+        if (field == EPOS_OUT_CW || !(changed & (1 << field)))
+            continue;
+        for (i = 0; i < pdos->count; i++)
+            _add_pdo (list, &count, pdos->pdo[i]);
+    }
+
+    if (changed == EPOS_OUT_ALL) {
+        // forced, all of them
+        for (i = 0; i < cw->count; i++)
+            _add_pdo (list, &count, cw->pdo[i]);
+    } else if ((changed & (1 << EPOS_OUT_CW)) && cw->count > 0) {
+        // already going out with another field?
+        int sent = 0, j;
+        for (i = 0; i < cw->count && !sent; i++)
+            for (j = 0; j < count; j++)
+                if (list[j] == cw->pdo[i]) {
+                    sent = 1;
+                    break;
+                }
+        if (!sent)
+            _add_pdo (list, &count, cw->pdo[0]);
+    }
+
+    for (i = 0; i < count; i++)
+        sendOnePDOevent (epos->d, list[i]);
+}
+
+/*
+ * Name         : epos_send_outputs
+ *
+ * Synopsis     : void    epos_send_outputs (EPOS_drive_t * epos)
+ *
+ * Arguments    : EPOS_drive_t * epos : the EPOS context of the bus
+ *
+ * Description  : CAN side, mutex held. Loads the command images of all the drives and sends
+ *                the changed PDOs
+ * 
+ * Returns      : void
+ */
+void    epos_send_outputs (EPOS_drive_t * epos) {
+
+    int     idx;
+
+    for (idx = 0; idx < epos->epos_slave_count; idx++)
+        epos_send_drive_outputs (epos, idx);
+}
+
+/*
+    Posts a ControlWord transition for update() to merge. CAN side only (status word
+    callback, PPM queue)
+*/
+static void _cw_request (EPOS_drive_t * epos, int idx, UNS16 set, UNS16 clear) {
+
+    UNS32   old, new;
+
+    do {
+        old = epos->can[idx].cw_request;
+        new = (UNS32)((CW_REQ_SET(old) & ~clear) | set) |
+            (UNS32)((CW_REQ_CLEAR(old) & ~set) | clear) << 16;
+    } while (!__sync_bool_compare_and_swap (&epos->can[idx].cw_request, old, new));
+}
+
+/*
+    Publishes the drive feedback from the OD. PDO callbacks only (single writer)
+*/
+static void _publish_inputs (EPOS_drive_t * epos, int idx) {
+
+    EPOS_in_image_t     image;
+
+    image.StatusWord = epos->od.StatusWord[idx];
+    image.OperationModeDisplay = epos->od.OperationModeDisplay[idx];
+    image.PositionActualValue = epos->od.PositionActualValue[idx];
+    image.VelocityActualValue = epos->od.VelocityActualValue[idx];
+    image.DigitalIn = epos->od.DigitalIn[idx];
+
+    DBUF_WRITE (epos->can[idx].in_shared, image);
+}
+
+/*
+    Publishes the input image if the object closes an RPDO of the drive
+*/
+static void _publish_rpdo (EPOS_drive_t * epos, int idx, UNS16 index) {
+
+    int     object;
+
+    for (object = 0; object < OBJ_COUNT(_in_objects); object++)
+        if (_in_objects[object] == index) {
+            if (epos->can[idx].rx_last & (1 << object))
+                _publish_inputs (epos, idx);
+            return;
+        }
+}
+
+static UNS32 _inputCB (CO_Data * d, const indextable *idxtbl, UNS8 bSubindex) {
+
+    EPOS_drive_t    *epos = epos_ctx (d);
+
+    // bSubindex is the array item (eq. drive idx + 1)
+    _publish_rpdo (epos, bSubindex - 1, idxtbl->index);
+
+    return OD_SUCCESSFUL;
+}
+
+/*
+    PPM state from the ControlWord / StatusWord pair
+*/
+static PPM_State_t _PPM_state (UNS16 cw, UNS16 sw) {
+
+    if (BIT_IS_SET(cw, 4))
+        if (BIT_IS_SET(sw, 12))
+            return PPM_Acknowledged;
+        else
+            return PPM_Sent;
+    else if (BIT_IS_SET(sw, 12))
+        return PPM_Running;
+    else
+        return PPM_Ready;
+}
+
+/*
+ * the status word callback does the state machines for the DS402
  *
  *
  *
@@ -504,12 +1404,20 @@ static int debug = 1;
 static int debug = 0;
 #endif
 static UNS32 _statusWordCB (CO_Data * d, const indextable *idxtbl, UNS8 bSubindex) {
-    
+
+    EPOS_drive_t    *epos = epos_ctx (d);
+
     // idx is the OD entry, bSubindex is the array item in it (eq. drive idx + 1)
     int     idx = bSubindex - 1;
 
-    // update the state for the corresponding drive based on the status word
-    EPOS_drive.EPOS_State[idx] = (*(UNS16 *)(idxtbl->pSubindex[bSubindex].pObject)) & 0x417F;
+    // the state for the corresponding drive based on the status word
+    UNS16   sw = *(UNS16 *)(idxtbl->pSubindex[bSubindex].pObject);
+    UNS16   state = sw & 0x417F;
+    // send right away, even when deferred
+    int     urgent = 0;
+
+    // make the new status visible to update(), once the whole RPDO is in
+    _publish_rpdo (epos, idx, idxtbl->index);
     
     /*
         Possible external commands:
@@ -539,7 +1447,8 @@ static UNS32 _statusWordCB (CO_Data * d, const indextable *idxtbl, UNS8 bSubinde
     */
     
     /***** NOTE: callback from PDO, NO MUTEXES! ****/
-    switch (EPOS_drive.EPOS_State[idx]) {
+    /* the ControlWord is owned by update(), transitions go through _cw_request */
+    switch (state) {
         case EPOS_START:
             // state: bootup
             // possible transitions:
@@ -562,16 +1471,9 @@ static UNS32 _statusWordCB (CO_Data * d, const indextable *idxtbl, UNS8 bSubinde
             // 2 -> RSO (ready to switch on) (manual) (user, function)
             if (debug) eprintf("Switch On Disabled\n");
             /* should be done if we REQUESTED to turn on */
-            //EnterMutex();
         
             // clear the Fault Reset bit here, fault was reset
-            CLEAR_BIT (ControlWord[idx], 7);
-            
-            /*SET_BIT(ControlWord[idx], 2);
-            SET_BIT(ControlWord[idx], 1);
-            CLEAR_BIT(ControlWord[idx], 0);*/
-            
-            //LeaveMutex();
+            _cw_request (epos, idx, 0, 1 << 7);
             break;
         case EPOS_RSO:
             // state: drive function disabled
@@ -583,11 +1485,7 @@ static UNS32 _statusWordCB (CO_Data * d, const indextable *idxtbl, UNS8 bSubinde
             if (debug) eprintf("Ready to Switch On\n");
             /* 3 if requested to turn on, 7 if requested to shut down */
             // this is #3
-            //EnterMutex();
-            SET_BIT(ControlWord[idx], 2);
-            SET_BIT(ControlWord[idx], 1);
-            SET_BIT(ControlWord[idx], 0);
-            //LeaveMutex();
+            _cw_request (epos, idx, (1 << 2) | (1 << 1) | (1 << 0), 0);
             break;
         case EPOS_SWO:
             // state: drive function disabled
@@ -599,12 +1497,7 @@ static UNS32 _statusWordCB (CO_Data * d, const indextable *idxtbl, UNS8 bSubinde
             if (debug) eprintf("Switched on\n");
             /* 4 if requested to turn on, 6 or 10 if requested to shut down */
             // this is #4
-            //EnterMutex();
-            SET_BIT(ControlWord[idx], 3);
-            SET_BIT(ControlWord[idx], 2);
-            SET_BIT(ControlWord[idx], 1);
-            SET_BIT(ControlWord[idx], 0);
-            //LeaveMutex();
+            _cw_request (epos, idx, (1 << 3) | (1 << 2) | (1 << 1) | (1 << 0), 0);
             break;
         case EPOS_REFRESH:
             // state: refresh power stage
@@ -636,7 +1529,11 @@ static UNS32 _statusWordCB (CO_Data * d, const indextable *idxtbl, UNS8 bSubinde
             // transition 9 to switch on disabled
             // transition 11 to quick stop active
             
-            /* implement QuickStop pin handling */
+            // quick stop requested while the drive was getting here, stop it now
+            if (epos->cmd[idx].quick_stop) {
+                _cw_request (epos, idx, 0, 1 << 2);
+                urgent = 1;
+            }
             
             break;
         case EPOS_QUICKS:
@@ -649,7 +1546,7 @@ static UNS32 _statusWordCB (CO_Data * d, const indextable *idxtbl, UNS8 bSubinde
             // transition 16 to operation enable
             // transition 12 to switch on disabled
             
-            /* implement QuickStop pin handling */
+            // transition 16 is done by update() when the quick stop is released (epos_quick_stop)
             
             break;
         case EPOS_FRAD:
@@ -671,243 +1568,896 @@ static UNS32 _statusWordCB (CO_Data * d, const indextable *idxtbl, UNS8 bSubinde
             if (debug) eprintf("Fault\n");
             break;
         default:
-            eprintf("Bored to input codes. Unknown code %04x\n", EPOS_drive.EPOS_State[idx]);
+            eprintf("Bored to input codes. Unknown code %04x\n", state);
+    }
+
+    // Do the PPM state machine, based on the ControlWord last sent
+    // the only transition at this point is from ACK to RUN
+
+    if (epos->od.OperationMode[idx] == EPOS_MODE_PPM && _PPM_state (epos->od.ControlWord[idx], sw) == PPM_Acknowledged) {
+        
+        // transition to Running by clearing the ControlWord bit
+        _cw_request (epos, idx, 0, 1 << 4);
+        // a queued set-point was taken
+        epos->can[idx].ppm_pending = 0;
+    }
+
+    // homing in progress (attained low) after the start bit went out. update() trusts the
+    // attained / error bits only after this, older status words may still carry them
+    if (epos->od.OperationMode[idx] == EPOS_MODE_HMM && BIT_IS_SET(epos->od.ControlWord[idx], 4) && !BIT_IS_SET(sw, 12))
+        epos->can[idx].hmm_started = 1;
+        
+    // send the updates (observing the mapping)
+    // in deferred mode the requests stay in the mailbox, the next cycle sends them
+    if (!epos->cw_deferred || urgent)
+        epos_send_drive_outputs (epos, idx);
+
+    return OD_SUCCESSFUL;
+}
+
+void    update_PPM (EPOS_drive_t * epos, int idx) {
+    
+    // update the current state, as seen by this cycle
+    epos->rt[idx].EPOS_PPMState = _PPM_state (epos->rt[idx].out.ControlWord, epos->rt[idx].in.StatusWord);
+
+#ifdef __DEBUG__        
+    switch (epos->rt[idx].EPOS_PPMState) {
+        case PPM_Acknowledged:
+            eprintf ("PPM acknowledged\n");
+            break;
+        case PPM_Sent:
+            eprintf ("PPM sent\n");
+            break;
+        case PPM_Running:
+            eprintf ("PPM running\n");
+            break;
+        case PPM_Ready:
+            eprintf ("PPM ready\n");
+            break;
+    }
+#endif
+}
+
+/*
+    Verifies if the PPM is ready to do a move
+*/
+int     epos_can_do_PPM (EPOS_drive_t * epos, int idx) {
+    
+    // update the PPM state
+    update_PPM (epos, idx);
+    
+    // ensure we're in the proper PPM and also the drive is OPERATIONAL
+    return epos->rt[idx].EPOS_PPMState == PPM_Ready &&
+        epos_drive_operational(epos, idx) &&
+        epos_get_mode (epos, idx) == EPOS_MODE_PPM;
+}
+
+int     epos_do_move_PPM (EPOS_drive_t * epos, int idx, INTEGER32 position) {
+    
+    if (epos_can_do_PPM(epos, idx)) {
+        // load the position into the command image (0x4062[idx+1])
+        epos->rt[idx].out.PositionDemandValue = position;
+        // set the bit for the control word. Both are published together
+        SET_BIT(epos->rt[idx].out.ControlWord,4);
+        /*
+         * disabled the PDO sending here, we need to rely on the higher level caller
+         * to determine WHEN we need to send the PDOs
+         */
+        // send the PDO for the MOVE (observing the mapping)
+        //sendPDOevent(epos->d);
+        // other possibility is to send just the PDO nr 1 for the index
+        //sendOnePDOevent(epos->d, 1 + (idx * EPOS_PDO_MAX));
+        return 1;
+    }
+    
+    return 0;
+}
+
+/*
+*/
+/*
+    PPM set-point queue
+
+    update() pushes every new set-point (epos_queue_PPM), the CAN side pops them with the
+    handshake: a set-point is sent along with the New set-point bit when the drive is ready,
+    the acknowledge clears the bit, the drive clearing the acknowledge makes it ready again.
+    This runs on every PDO send, so the rate is bounded by the PDO round trip and not by
+    the update() period. Single producer (RT) / single consumer (CAN side, mutex held)
+*/
+
+/*
+ * Name         : epos_set_ppm_queue
+ *
+ * Synopsis     : int     epos_set_ppm_queue (EPOS_drive_t * epos, int depth, int buffered)
+ *
+ * Arguments    : EPOS_drive_t * epos : the EPOS context of the bus
+ *                int  depth : set-points per drive, 0 disables the queue
+ *                int  buffered : 1 - send every set-point to the drive set-point buffer
+ *
+ * Description  : configures the PPM set-point queue, before the drives are started
+ * 
+ * Returns      : int     0 if the depth is out of range
+ */
+
+int     epos_set_ppm_queue (EPOS_drive_t * epos, int depth, int buffered) {
+    
+    if (depth < 0 || depth > EPOS_PPM_QUEUE_MAX)
+        return 0;
+    
+    epos->ppm_depth = depth;
+    epos->ppm_buffered = buffered ? 1 : 0;
+    
+    return 1;
+}
+
+int     epos_queue_PPM (EPOS_drive_t * epos, int idx, INTEGER32 position) {
+    
+    EPOS_drive_rt_t *rt = &epos->rt[idx];
+    unsigned        head = rt->ppm_head;
+    
+    if (head - epos->can[idx].ppm_tail >= epos->ppm_depth) {
+        rt->ppm_overflows++;
+        return 0;
     }
+    
+    epos->ppm_points[idx][head % epos->ppm_depth] = position;
+    // the set-point must be there before the consumer sees the new head
+    __sync_synchronize ();
+    rt->ppm_head = head + 1;
+    
+    return 1;
+}
 
-    // Do the PPM state machine
-    // first, update the current state
-    update_PPM (idx);
+int     epos_PPM_fill (EPOS_drive_t * epos, int idx) {
     
-    // now, see what transition is needed. The only transition at this point is from ACK to RUN
+    return epos->rt[idx].ppm_head - epos->can[idx].ppm_tail;
+}
 
-    if (EPOS_drive.EPOS_PPMState[idx] == PPM_Acknowledged) {
-        
-        // transition to Running by clearing the ControlWord bit
-        CLEAR_BIT(ControlWord[idx], 4);
+/*
+    CAN side, from epos_load_outputs with the drive commanded in PPM. Starts the next
+    set-point when the drive is ready for it. Returns 1 if it did
+*/
+static int  _ppm_next (EPOS_drive_t * epos, int idx) {
+    
+    EPOS_drive_can_t    *can = &epos->can[idx];
+    unsigned            head = epos->rt[idx].ppm_head;
+    unsigned            tail = can->ppm_tail;
+    
+    // not operational, the queued set-points are stale
+    if ((epos->od.StatusWord[idx] & 0x417F) != EPOS_OPEN) {
+        can->ppm_tail = head;
+        can->ppm_pending = 0;
+        return 0;
     }
-        
-    // send the updates (observing the mapping)
-    sendPDOevent(d);
-    //sendOnePDOevent(EPOS_drive.d, 0 + (idx * EPOS_PDO_MAX));
+    
+    // the handshake uses the ControlWord last sent
+    if (can->ppm_pending || head == tail ||
+        _PPM_state (epos->od.ControlWord[idx], epos->od.StatusWord[idx]) != PPM_Ready)
+        return 0;
+    
+    // look ahead, with change set immediately only the newest one matters
+    if (!epos->ppm_buffered)
+        tail = head - 1;
+    
+    __sync_synchronize ();
+    can->ppm_target = epos->ppm_points[idx][tail % epos->ppm_depth];
+    // done with the slot before handing it back
+    __sync_synchronize ();
+    can->ppm_tail = tail + 1;
+    
+    can->ppm_pending = 1;
+    // for update() to merge, the ack clears it
+    _cw_request (epos, idx, 1 << 4, 0);
+    
+    return 1;
+}
 
-    return OD_SUCCESSFUL;
+/*
+    Homing Mode
+
+    epos_start_homing writes the homing configuration with a background SDO batch, then
+    update_HMM starts the homing with ControlWord bit 4 once the drive is operational in
+    HMM, and watches the StatusWord: bit 13 homing error, bit 12 homing attained along with
+    bit 10 target reached. The drive homes on its own, update() only follows it
+*/
+int     epos_start_homing (EPOS_drive_t * epos, int idx, const EPOS_homing_t *cfg) {
+    
+    HMM_State_t state = epos->rt[idx].hmm_state;
+    
+    // already homing
+    if (state != HMM_Idle && state != HMM_Done && state != HMM_Error)
+        return 0;
+    
+    // copied to the SDO data once the channel is free
+    epos->cold.homing_req[idx] = *cfg;
+    epos->rt[idx].hmm_state = HMM_Queue;
+    
+    return 1;
+}
+
+void    epos_stop_homing (EPOS_drive_t * epos, int idx) {
+    
+    switch (epos->rt[idx].hmm_state) {
+        case HMM_Running:
+            CLEAR_BIT (epos->rt[idx].out.ControlWord, 4);
+            // fall through
+        case HMM_Queue:
+        case HMM_Config:
+        case HMM_Start:
+            // a configuration batch still in flight is ignored when it completes
+            epos->rt[idx].hmm_state = HMM_Idle;
+            break;
+        default:
+            break;
+    }
 }
 
-void    update_PPM (int idx) {
+/* stops the homing and forgets its result, the drive left Operation Enabled or booted again */
+void    epos_reset_homing (EPOS_drive_t * epos, int idx) {
     
-    // update the current state
-    if (BIT_IS_SET(ControlWord[idx],4))
-        if (BIT_IS_SET(StatusWord[idx], 12))
-            EPOS_drive.EPOS_PPMState[idx] = PPM_Acknowledged;
-        else
-            EPOS_drive.EPOS_PPMState[idx] = PPM_Sent;
-    else if (BIT_IS_SET(StatusWord[idx], 12))
-            EPOS_drive.EPOS_PPMState[idx] = PPM_Running;
-        else
-            EPOS_drive.EPOS_PPMState[idx] = PPM_Ready;    
+    epos_stop_homing (epos, idx);
+    epos->rt[idx].hmm_state = HMM_Idle;
+}
 
-#ifdef __DEBUG__        
-    switch (EPOS_drive.EPOS_PPMState[idx]) {
-        case PPM_Acknowledged:
-            eprintf ("PPM acknowledged\n");
+/* queues the homing configuration, 0 if the SDO channel is busy */
+static int  _queue_homing (EPOS_drive_t * epos, int idx) {
+    
+    EPOS_homing_t   *cfg = &epos->cold.homing[idx];
+    
+    if (!_init_sdo_transfer (epos, idx))
+        return 0;
+    
+    *cfg = epos->cold.homing_req[idx];
+    
+    _add_sdo_transfer (epos, idx, 0x6098, 0x00, sizeof (cfg->method), &cfg->method);
+    _add_sdo_transfer (epos, idx, 0x607C, 0x00, sizeof (cfg->offset), &cfg->offset);
+    if (cfg->speed_switch)
+        _add_sdo_transfer (epos, idx, 0x6099, 0x01, sizeof (cfg->speed_switch), &cfg->speed_switch);
+    if (cfg->speed_zero)
+        _add_sdo_transfer (epos, idx, 0x6099, 0x02, sizeof (cfg->speed_zero), &cfg->speed_zero);
+    if (cfg->accel)
+        _add_sdo_transfer (epos, idx, 0x609A, 0x00, sizeof (cfg->accel), &cfg->accel);
+    
+    return _execute_sdo_transfer (epos, idx, SDO_WRITE, EPOS_SDO_TAG_HOMING);
+}
+
+void    update_HMM (EPOS_drive_t * epos, int idx) {
+    
+    EPOS_drive_rt_t *rt = &epos->rt[idx];
+    UNS16           sw = rt->in.StatusWord;
+    
+    switch (rt->hmm_state) {
+        case HMM_Queue:
+            if (_queue_homing (epos, idx))
+                rt->hmm_state = HMM_Config;
             break;
-        case PPM_Sent:
-            eprintf ("PPM sent\n");
+            
+        case HMM_Start:
+            // the previous start bit must be seen cleared by the CAN side first
+            if (epos_drive_operational (epos, idx) && epos_get_mode (epos, idx) == EPOS_MODE_HMM &&
+                !epos->can[idx].hmm_started) {
+                SET_BIT (rt->out.ControlWord, 4);
+                rt->hmm_state = HMM_Running;
+            }
             break;
-        case PPM_Running:
-            eprintf ("PPM running\n");
+            
+        case HMM_Running:
+            if (!epos->can[idx].hmm_started || epos_get_mode (epos, idx) != EPOS_MODE_HMM)
+                break;
+            
+            if (BIT_IS_SET(sw, 13)) {
+                CLEAR_BIT (rt->out.ControlWord, 4);
+                rt->hmm_state = HMM_Error;
+            } else if (BIT_IS_SET(sw, 12) && BIT_IS_SET(sw, 10)) {
+                CLEAR_BIT (rt->out.ControlWord, 4);
+                rt->hmm_state = HMM_Done;
+            }
             break;
-        case PPM_Ready:
-            eprintf ("PPM ready\n");
+            
+        default:
+            // HMM_Config moves on with the SDO completion
             break;
     }
-#endif
+}
+
+void    epos_homing_done (EPOS_drive_t * epos, const SDO_completion_t *result) {
+    
+    EPOS_drive_rt_t *rt = &epos->rt[result->idx];
+    
+    // stopped meanwhile
+    if (rt->hmm_state != HMM_Config)
+        return;
+    
+    rt->hmm_state = (result->error == OD_SUCCESSFUL) ? HMM_Start : HMM_Error;
+}
+
+HMM_State_t epos_get_homing (EPOS_drive_t * epos, int idx) {
+    
+    return epos->rt[idx].hmm_state;
 }
 
 /*
-    Verifies if the PPM is ready to do a move
+    Profile Velocity Mode / Velocity Mode. No handshake, a new velocity is taken right away,
+    in PVM the drive profile generator ramps to it. Only sent when it changes (epos_load_outputs)
 */
-int     epos_can_do_PPM (int idx) {
+void    epos_set_velocity (EPOS_drive_t * epos, int idx, INTEGER32 velocity) {
     
-    // update the PPM state
-    update_PPM (idx);
+    epos->rt[idx].out.VelocityDemandValue = velocity;
+}
+
+void    epos_set_target_velocity (EPOS_drive_t * epos, int idx, INTEGER32 velocity) {
     
-    // ensure we're in the proper PPM and also the drive is OPERATIONAL
-    return EPOS_drive.EPOS_PPMState[idx] == PPM_Ready &&
-        epos_drive_operational(idx) &&
-        epos_get_mode (idx) == EPOS_MODE_PPM;
+    epos->rt[idx].out.TargetVelocity = velocity;
 }
 
-int     epos_do_move_PPM (int idx, INTEGER32 position) {
+int     epos_velocity_reached (EPOS_drive_t * epos, int idx) {
     
-    if (epos_can_do_PPM(idx)) {
-        // load the position into 0x4062[idx+1]
-        PositionDemandValue[idx] = position;
-        // set the bit for the control word
-        SET_BIT(ControlWord[idx],4);
-        /*
-         * disabled the PDO sending here, we need to rely on the higher level caller
-         * to determine WHEN we need to send the PDOs
-         */
-        // send the PDO for the MOVE (observing the mapping)
-        //sendPDOevent(EPOS_drive.d);
-        // other possibility is to send just the PDO nr 1 for the index
-        //sendOnePDOevent(EPOS_drive.d, 1 + (idx * EPOS_PDO_MAX));
-        return 1;
-    }
+    // bit 10 is target reached in PVM
+    return epos_get_mode (epos, idx) == EPOS_MODE_PVM && BIT_IS_SET (epos->rt[idx].in.StatusWord, 10);
+}
+
+int     epos_in_position (EPOS_drive_t * epos, int idx) {
     
-    return 0;
+    return BIT_IS_SET (epos->rt[idx].in.StatusWord, 10);
 }
 
-/*
-*/
-int     epos_in_position (int idx) {
+void    epos_set_absolute (EPOS_drive_t * epos, int idx) {
+    
+    CLEAR_BIT(epos->rt[idx].out.ControlWord, 6);
+}
+
+void    epos_set_relative (EPOS_drive_t * epos, int idx) {
     
-    return BIT_IS_SET (StatusWord[idx], 10);
+    SET_BIT(epos->rt[idx].out.ControlWord, 6);
 }
 
-void    epos_set_absolute (int idx) {
+void    epos_set_continuous (EPOS_drive_t * epos, int idx) {
     
-    CLEAR_BIT(ControlWord[idx], 6);
+    SET_BIT(epos->rt[idx].out.ControlWord, 5);
 }
 
-void    epos_set_relative (int idx) {
+void    epos_set_segmented (EPOS_drive_t * epos, int idx) {
     
-    SET_BIT(ControlWord[idx], 6);
+    CLEAR_BIT(epos->rt[idx].out.ControlWord, 5);
 }
 
-void    epos_set_continuous (int idx) {
+/* PPM: keep the set-points in the drive buffer and blend them (change on set-point) */
+void    epos_set_buffered (EPOS_drive_t * epos, int idx) {
     
-    SET_BIT(ControlWord[idx], 5);
+    CLEAR_BIT(epos->rt[idx].out.ControlWord, 5);
+    SET_BIT(epos->rt[idx].out.ControlWord, 9);
 }
 
-void    epos_set_segmented (int idx) {
+void    epos_halt (EPOS_drive_t * epos, int idx) {
+    
+    SET_BIT(epos->rt[idx].out.ControlWord, 8);
+}
+
+/*
+    Quick stop, transition 11 (OPEN -> QUICKS) and 16 (QUICKS -> OPEN) via ControlWord bit 2
+    Returns 1 if the ControlWord changed, so the caller can send it right away
+*/
+int     epos_quick_stop (EPOS_drive_t * epos, int idx, int active) {
+    
+    EPOS_drive_rt_t *rt = &epos->rt[idx];
+    UNS16           cw = rt->out.ControlWord;
+    
+    // the status word callback stops a drive reaching OPEN meanwhile
+    epos->cmd[idx].quick_stop = active ? 1 : 0;
+    
+    if (active && rt->EPOS_State == EPOS_OPEN)
+        CLEAR_BIT (rt->out.ControlWord, 2);
+    else if (!active && rt->EPOS_State == EPOS_QUICKS)
+        SET_BIT (rt->out.ControlWord, 2);
     
-    CLEAR_BIT(ControlWord[idx], 5);
+    return rt->out.ControlWord != cw;
 }
 
-void    epos_halt (int idx) {
+int     epos_quick_stop_active (EPOS_drive_t * epos, int idx) {
     
-    SET_BIT(ControlWord[idx], 8);
+    return epos->rt[idx].EPOS_State == EPOS_QUICKS;
 }
 
-void    epos_execute (int idx) {
+void    epos_execute (EPOS_drive_t * epos, int idx) {
     
-    CLEAR_BIT(ControlWord[idx], 8);
+    CLEAR_BIT(epos->rt[idx].out.ControlWord, 8);
 }
 
 
-void    epos_enable_drive (int idx) {
+void    epos_enable_drive (EPOS_drive_t * epos, int idx) {
     
     /* enables the drive function. Drive must be in SOD */
     
-    if (EPOS_drive.EPOS_State[idx] == EPOS_SOD) {
+    if (epos->rt[idx].EPOS_State == EPOS_SOD) {
         
         /* do transition 2 */
-        SET_BIT (ControlWord[idx], 2);
-        SET_BIT (ControlWord[idx], 1);
-        CLEAR_BIT (ControlWord[idx], 0);
+        SET_BIT (epos->rt[idx].out.ControlWord, 2);
+        SET_BIT (epos->rt[idx].out.ControlWord, 1);
+        CLEAR_BIT (epos->rt[idx].out.ControlWord, 0);
     }
 }
 
-void    epos_disable_drive (int idx) {
+void    epos_disable_drive (EPOS_drive_t * epos, int idx) {
     
     /* disables the drive function. Drive must be either OPEN or QUICKS */
 
-    if (EPOS_drive.EPOS_State[idx] == EPOS_OPEN || EPOS_drive.EPOS_State[idx] == EPOS_QUICKS) {
+    if (epos->rt[idx].EPOS_State == EPOS_OPEN || epos->rt[idx].EPOS_State == EPOS_QUICKS) {
         
         /* do transition 9/12 via Voltage Disable */
-        CLEAR_BIT (ControlWord[idx], 1);
+        CLEAR_BIT (epos->rt[idx].out.ControlWord, 1);
     }    
 }
 
-void    epos_fault_reset (int idx) {
+void    epos_fault_reset (EPOS_drive_t * epos, int idx) {
     
-    if (EPOS_drive.EPOS_State[idx] == EPOS_FAULT) {
+    if (epos->rt[idx].EPOS_State == EPOS_FAULT) {
         
         /* do transition 15 via Fault Reset */
-        SET_BIT (ControlWord[idx], 7);
+        SET_BIT (epos->rt[idx].out.ControlWord, 7);
     }
 }
 
-int     epos_drive_operational (int idx) {
+int     epos_drive_operational (EPOS_drive_t * epos, int idx) {
     
-    if (EPOS_drive.EPOS_State[idx] == EPOS_OPEN || EPOS_drive.EPOS_State[idx] == EPOS_QUICKS)
+    if (epos->rt[idx].EPOS_State == EPOS_OPEN || epos->rt[idx].EPOS_State == EPOS_QUICKS)
         return 1;
     
     return 0;
 }
 
-int     epos_drive_faulted (int idx) {
+int     epos_drive_faulted (EPOS_drive_t * epos, int idx) {
     
-    if (EPOS_drive.EPOS_State[idx] == EPOS_FAULT)
+    if (epos->rt[idx].EPOS_State == EPOS_FAULT)
         return 1;
     
     return 0;
 }
 
-int     epos_drive_disabled (int idx) {
+int     epos_drive_disabled (EPOS_drive_t * epos, int idx) {
     
-    if (EPOS_drive.EPOS_State[idx] != EPOS_OPEN && EPOS_drive.EPOS_State[idx] != EPOS_QUICKS && EPOS_drive.EPOS_State[idx] != EPOS_FAULT)
+    if (epos->rt[idx].EPOS_State != EPOS_OPEN && epos->rt[idx].EPOS_State != EPOS_QUICKS && epos->rt[idx].EPOS_State != EPOS_FAULT)
         return 1;
     
     return 0;
 }
 
-void    epos_set_mode (int idx, EPOS_DriveMode_t mode) {
+void    epos_set_mode (EPOS_drive_t * epos, int idx, EPOS_DriveMode_t mode) {
     
-    OperationMode[idx] = mode;
+    epos->rt[idx].out.OperationMode = mode;
 }
 
-EPOS_DriveMode_t    epos_get_mode (int idx) {
+EPOS_DriveMode_t    epos_get_mode (EPOS_drive_t * epos, int idx) {
     
-    return OperationModeDisplay[idx];
+    return epos->rt[idx].in.OperationModeDisplay;
 }
 
 
-void    _init_sdo_transfer (int idx) {
+/*
+    Asynchronous SDO batches
+
+    Each drive has one batch of up to MAX_SDO_ITEMS reads or writes. The RT side fills it in
+    and queues it (_init/_add/_execute_sdo_transfer), the CAN timer thread runs the items one
+    after the other on the drive's client SDO, chaining them from the CanFestival callbacks.
+    Finished batches go to a single producer / single consumer ring the RT side drains with
+    _get_sdo_transfer_result, so the RT side never takes the CAN mutex nor waits on the bus.
+    The item data must stay valid until the completion is reported.
+*/
+#define EPOS_SDO_ALARM_ID   0x5D05D05D
+#define SDO_TIMEOUT_TICKS   (EPOS_SDO_TIMEOUT_MS / EPOS_SDO_CYCLE_MS)
+#define SDO_ABORT_TIMEOUT   0x05040000  // SDO protocol timed out
+#define SDO_ABORT_GENERAL   0x08000000  // general error
+#define SDO_ABORT_STATE     0x08000022  // not possible in the present device state (slave rebooted)
+
+static void _sdo_callback (CO_Data * d, UNS8 nodeid);
+
+int     _init_sdo_transfer (EPOS_drive_t * epos, int idx) {
 
-    EPOS_drive.sdos[idx].count = 0;
-    EPOS_drive.sdos[idx].cursor = -1;
-    EPOS_drive.sdos[idx].state = SDO_RESET;
-    EPOS_drive.sdos[idx].error = OD_SUCCESSFUL;
-    EPOS_drive.sdos[idx].type = SDO_INIT;
+    // previous batch still in flight or not reported yet
+    if (epos->cold.sdos[idx].state != SDO_BATCH_IDLE)
+        return 0;
+
+    epos->cold.sdos[idx].count = 0;
+    epos->cold.sdos[idx].cursor = -1;
+    epos->cold.sdos[idx].error = OD_SUCCESSFUL;
+    epos->cold.sdos[idx].tag = 0;
+    epos->cold.sdos[idx].ticks = 0;
+    epos->cold.sdos[idx].retry = 0;
+    epos->cold.sdos[idx].type = SDO_INIT;
+    
+    return 1;
 }
 
-int     _add_sdo_transfer (int idx, UNS16 obj, UNS8 sub, UNS32 size, void *data) {
+int     _add_sdo_transfer (EPOS_drive_t * epos, int idx, UNS16 obj, UNS8 sub, UNS32 size, void *data) {
         
-    if (EPOS_drive.sdos[idx].count >= MAX_SDO_ITEMS)
+    if (epos->cold.sdos[idx].state != SDO_BATCH_IDLE)
+        return 0;
+
+    if (epos->cold.sdos[idx].count >= MAX_SDO_ITEMS)
         return 0;
     
-    EPOS_drive.sdos[idx].items[EPOS_drive.sdos[idx].count].idx = obj;
-    EPOS_drive.sdos[idx].items[EPOS_drive.sdos[idx].count].sub = sub;
-    EPOS_drive.sdos[idx].items[EPOS_drive.sdos[idx].count].size = size;
-    EPOS_drive.sdos[idx].items[EPOS_drive.sdos[idx].count].data = data;
+    epos->cold.sdos[idx].items[epos->cold.sdos[idx].count].idx = obj;
+    epos->cold.sdos[idx].items[epos->cold.sdos[idx].count].sub = sub;
+    epos->cold.sdos[idx].items[epos->cold.sdos[idx].count].size = size;
+    epos->cold.sdos[idx].items[epos->cold.sdos[idx].count].data = data;
     
-    EPOS_drive.sdos[idx].count++;
+    epos->cold.sdos[idx].count++;
     
     return 1;
 }
 
-int     _execute_sdo_transfer (int idx, SDO_transfer_type_t type) {
+int     _execute_sdo_transfer (EPOS_drive_t * epos, int idx, SDO_transfer_type_t type, UNS32 tag) {
     
+    if (epos->cold.sdos[idx].state != SDO_BATCH_IDLE)
+        return 0;
+
     // empty?
-    if (EPOS_drive.sdos[idx].count < 1)
+    if (epos->cold.sdos[idx].count < 1)
         return 0;
     
     // invalid type
     if (type != SDO_READ && type != SDO_WRITE)
         return 0;
     
-    EPOS_drive.sdos[idx].type = type;
-    EPOS_drive.sdos[idx].cursor = -1;
+    epos->cold.sdos[idx].type = type;
+    epos->cold.sdos[idx].tag = tag;
+    epos->cold.sdos[idx].cursor = -1;
+    
+    // the batch must be complete before the timer thread can see it queued
+    __sync_synchronize ();
+    epos->cold.sdos[idx].state = SDO_BATCH_QUEUED;
+    
+    return 1;
+}
+
+int     _get_sdo_transfer_result (EPOS_drive_t * epos, SDO_completion_t *result) {
+    
+    SDO_ring_t  *ring = &epos->cold.sdo_ring;
+    unsigned    tail = ring->tail;
+    
+    if (tail == ring->head)
+        return 0;
+    
+    // read the entry only after seeing the producer's head
+    __sync_synchronize ();
+    *result = ring->entry[tail & (SDO_RING_SIZE - 1)];
+    // done with the entry before handing the slot back
+    __sync_synchronize ();
+    ring->tail = tail + 1;
+    
+    return 1;
+}
+
+/* CAN side. Reports a finished batch and frees it, 0 if the ring is full (retried next cycle) */
+static int  _sdo_report (EPOS_drive_t * epos, int idx) {
+    
+    SDO_transfer_t  *sdo = &epos->cold.sdos[idx];
+    SDO_ring_t      *ring = &epos->cold.sdo_ring;
+    unsigned        head = ring->head;
+    
+    if (head - ring->tail >= SDO_RING_SIZE)
+        return 0;
+    
+    SDO_completion_t    *entry = &ring->entry[head & (SDO_RING_SIZE - 1)];
+    
+    entry->idx = idx;
+    // on error the cursor stops on the failed item
+    entry->count = sdo->cursor;
+    entry->type = sdo->type;
+    entry->error = sdo->error;
+    entry->tag = sdo->tag;
+    
+    __sync_synchronize ();
+    ring->head = head + 1;
+    sdo->state = SDO_BATCH_IDLE;
+    
+    return 1;
+}
+
+static void _sdo_finish (EPOS_drive_t * epos, int idx, UNS32 error) {
+    
+    epos->cold.sdos[idx].error = error;
+    epos->cold.sdos[idx].state = SDO_BATCH_DONE;
+    _sdo_report (epos, idx);
+}
+
+/* CAN side. Starts the transfer of the current item */
+static void _sdo_start_item (EPOS_drive_t * epos, int idx) {
+    
+    SDO_transfer_t  *sdo = &epos->cold.sdos[idx];
+    SDO_item_t      *item = &sdo->items[sdo->cursor];
+    UNS8            nodeid = epos->epos_slaves[idx];
+    UNS8            res;
+    
+    if (sdo->type == SDO_READ)
+        res = readNetworkDictCallbackAI (epos->d, nodeid, item->idx, item->sub, 0, _sdo_callback, 0);
+    else
+        res = writeNetworkDictCallBackAI (epos->d, nodeid, item->idx, item->sub, item->size, 0, item->data,
+            _sdo_callback, 1, 0);
+    
+    // the client SDO is in use (e.g. by the boot process), try again on the next cycle
+    sdo->retry = (res != 0);
+}
+
+/* CAN side. Moves to the next item, or finishes the batch */
+static void _sdo_next (EPOS_drive_t * epos, int idx) {
+    
+    SDO_transfer_t  *sdo = &epos->cold.sdos[idx];
+    
+    sdo->cursor++;
+    sdo->ticks = 0;
+    
+    if (sdo->cursor >= sdo->count) {
+        _sdo_finish (epos, idx, OD_SUCCESSFUL);
+        return;
+    }
+    
+    _sdo_start_item (epos, idx);
+}
+
+static void _sdo_callback (CO_Data * d, UNS8 nodeid) {
+    
+    EPOS_drive_t    *epos = epos_ctx (d);
+    int     idx = epos_get_slave_index (epos, nodeid);
+    UNS32   abortCode = 0;
+    UNS32   size;
+    UNS8    res;
+    
+    // not ours, or a late answer for a batch that timed out
+    if (idx < 0 || epos->cold.sdos[idx].state != SDO_BATCH_BUSY) {
+        closeSDOtransfer (d, nodeid, SDO_CLIENT);
+        return;
+    }
+    
+    SDO_transfer_t  *sdo = &epos->cold.sdos[idx];
+    SDO_item_t      *item = &sdo->items[sdo->cursor];
+    
+    if (sdo->type == SDO_READ) {
+        size = item->size;
+        res = getReadResultNetworkDict (d, nodeid, item->data, &size, &abortCode);
+    } else {
+        res = getWriteResultNetworkDict (d, nodeid, &abortCode);
+    }
+    
+    if (res == SDO_UPLOAD_IN_PROGRESS || res == SDO_DOWNLOAD_IN_PROGRESS)
+        return;
+    
+    /* Finalise last SDO transfer with this node */
+    closeSDOtransfer (d, nodeid, SDO_CLIENT);
+    
+    if (res != SDO_FINISHED) {
+        EPOS_DBG ("SDO %04x/%02x on %02x aborted: %08x\n", item->idx, item->sub, nodeid, abortCode);
+        _sdo_finish (epos, idx, abortCode ? abortCode : SDO_ABORT_GENERAL);
+        return;
+    }
+    
+    // the actual size read
+    if (sdo->type == SDO_READ)
+        item->size = size;
+    
+    _sdo_next (epos, idx);
+}
+
+/*
+ * Name         : epos_sdo_cycle
+ *
+ * Synopsis     : void    epos_sdo_cycle (CO_Data * d, UNS32 id)
+ *
+ * Arguments    : CO_Data * d : CAN object dictionary
+ *                UNS32  id : alarm ID
+ *
+ * Description  : CAN timer alarm, mutex held. Starts the queued batches, retries the
+ *                items that could not get the client SDO, aborts the transfers that
+ *                timed out and reports the batches that did not fit in the ring
+ * 
+ * Returns      : void
+ */
+
+void    epos_sdo_cycle (CO_Data * d, UNS32 id) {
+    
+    EPOS_drive_t    *epos = epos_ctx (d);
+    int     idx;
+    
+    for (idx = 0; idx < epos->epos_slave_count; idx++) {
+        
+        SDO_transfer_t  *sdo = &epos->cold.sdos[idx];
+        
+        switch (sdo->state) {
+            case SDO_BATCH_QUEUED:
+                // see the items as the RT side wrote them
+                __sync_synchronize ();
+                sdo->state = SDO_BATCH_BUSY;
+                _sdo_next (epos, idx);
+                break;
+                
+            case SDO_BATCH_BUSY:
+                if (++sdo->ticks > SDO_TIMEOUT_TICKS) {
+                    if (!sdo->retry)
+                        closeSDOtransfer (d, epos->epos_slaves[idx], SDO_CLIENT);
+                    _sdo_finish (epos, idx, SDO_ABORT_TIMEOUT);
+                } else if (sdo->retry) {
+                    _sdo_start_item (epos, idx);
+                }
+                break;
+                
+            case SDO_BATCH_DONE:
+                _sdo_report (epos, idx);
+                break;
+                
+            default:
+                break;
+        }
+    }
+}
+
+/*
+ * Name         : epos_sdo_start
+ *
+ * Synopsis     : void    epos_sdo_start (CO_Data * d)
+ *
+ * Arguments    : CO_Data * d : CAN object dictionary
+ *
+ * Description  : arms the periodic SDO alarm. CAN side, mutex held (i.e. from the timer
+ *                loop init callback)
+ * 
+ * Returns      : void
+ */
+
+void    epos_sdo_start (CO_Data * d) {
+    
+    SetAlarm (d, EPOS_SDO_ALARM_ID, epos_sdo_cycle,
+        MS_TO_TIMEVAL(EPOS_SDO_CYCLE_MS), MS_TO_TIMEVAL(EPOS_SDO_CYCLE_MS));
+}
+
+/* the slave objects of the motion profile, in EPOS_profile_t order. All UNS32 */
+static const struct {
+    UNS16   idx;
+    UNS8    sub;
+} _profile_objects[EPOS_PROFILE_COUNT] = {
+    { 0x6081, 0x00 },
+    { 0x6083, 0x00 },
+    { 0x6084, 0x00 },
+    { 0x6065, 0x00 },
+};
+
+/*
+ * Name         : epos_update_profile
+ *
+ * Synopsis     : int     epos_update_profile (EPOS_drive_t * epos, int idx, const UNS32 *values)
+ *
+ * Arguments    : EPOS_drive_t * epos : the EPOS context of the bus
+ *                int  idx : index of the slave in the slave table
+ *                const UNS32 * values : EPOS_PROFILE_COUNT profile values, 0 leaves the drive value
+ *
+ * Description  : RT side. Queues a background SDO write of the profile values that changed
+ *                since the last write. Values that change while a batch is in flight are
+ *                picked up by the next call, so only the latest value is ever written
+ * 
+ * Returns      : int     1 if a batch was queued, 0 if nothing changed or the SDO channel is busy
+ */
+
+int     epos_update_profile (EPOS_drive_t * epos, int idx, const UNS32 *values) {
+    
+    int     n;
+    UNS8    changed = 0;
+    
+    for (n = 0; n < EPOS_PROFILE_COUNT; n++)
+        if (values[n] != 0 && values[n] != epos->cold.profile_sent[idx][n])
+            changed |= 1 << n;
+    
+    if (!changed || !_init_sdo_transfer (epos, idx))
+        return 0;
+    
+    for (n = 0; n < EPOS_PROFILE_COUNT; n++) {
+        if (!(changed & (1 << n)))
+            continue;
+        
+        // the batch points here until it completes
+        epos->cold.profile[idx][n] = values[n];
+        _add_sdo_transfer (epos, idx, _profile_objects[n].idx, _profile_objects[n].sub,
+            sizeof (UNS32), &epos->cold.profile[idx][n]);
+        // assume written, a failed value is not retried until it changes again
+        epos->cold.profile_sent[idx][n] = values[n];
+    }
+    
+    epos->cold.profile_queued[idx] = changed;
+    
+    return _execute_sdo_transfer (epos, idx, SDO_WRITE, EPOS_SDO_TAG_PROFILE);
+}
+
+/*
+ * Name         : epos_profile_done
+ *
+ * Synopsis     : int     epos_profile_done (EPOS_drive_t * epos, const SDO_completion_t *result)
+ *
+ * Arguments    : EPOS_drive_t * epos : the EPOS context of the bus
+ *                const SDO_completion_t * result : the completion of a profile batch
+ *
+ * Description  : RT side. On abort, the values queued after the failed one were never
+ *                written, forget them so the next epos_update_profile sends them again
+ * 
+ * Returns      : int     the failed EPOS_profile_t, -1 if the batch succeeded
+ */
+
+int     epos_profile_done (EPOS_drive_t * epos, const SDO_completion_t *result) {
+    
+    int     n, item = 0, failed = -1;
+    int     idx = result->idx;
+    
+    if (result->error == OD_SUCCESSFUL)
+        return -1;
+    
+    for (n = 0; n < EPOS_PROFILE_COUNT; n++) {
+        if (!(epos->cold.profile_queued[idx] & (1 << n)))
+            continue;
+        
+        if (item == result->count)
+            failed = n;
+        else if (item > result->count)
+            epos->cold.profile_sent[idx][n] = 0;
+        item++;
+    }
+    
+    return failed;
+}
+
+/*
+ * Name         : epos_slave_booted
+ *
+ * Synopsis     : void    epos_slave_booted (EPOS_drive_t * epos, UNS8 slaveid)
+ *
+ * Arguments    : EPOS_drive_t * epos : the EPOS context of the bus
+ *                UNS8  slaveid : slave ID
+ *
+ * Description  : CAN side, mutex held. Called on a bootup frame of the slave (NMT reset or
+ *                reboot), ahead of the DS-302 slave boot. A batch on the bus is aborted, so the
+ *                client SDO is free for the boot. The drive is back to its defaults,
+ *                epos_check_boot picks it up on the RT side
+ * 
+ * Returns      : void
+ */
+
+void    epos_slave_booted (EPOS_drive_t * epos, UNS8 slaveid) {
+    
+    int     idx = epos_get_slave_index (epos, slaveid);
+    
+    if (idx < 0)
+        return;
     
-    // go to the transfer routine. The routine will 
-    //_sdo_handler (EPOS_data.d, EPOS_drive.epos_slaves[idx]);
+    // the answer is never coming, the boot needs the client SDO right away
+    if (epos->cold.sdos[idx].state == SDO_BATCH_BUSY) {
+        if (!epos->cold.sdos[idx].retry)
+            closeSDOtransfer (epos->d, slaveid, SDO_CLIENT);
+        _sdo_finish (epos, idx, SDO_ABORT_STATE);
+    }
+    
+    epos->can[idx].boots++;
 }
 
-int     _get_sdo_transfer_result (int idx) {
+/*
+ * Name         : epos_check_boot
+ *
+ * Synopsis     : int     epos_check_boot (EPOS_drive_t * epos, int idx)
+ *
+ * Arguments    : EPOS_drive_t * epos : the EPOS context of the bus
+ *                int  idx : index of the slave in the slave table
+ *
+ * Description  : RT side, once per cycle. After a slave bootup, forgets the profile values
+ *                written to the drive so the next epos_update_profile sends them again, and
+ *                the homing state (the drive is no longer homed)
+ * 
+ * Returns      : int     1 if the slave booted since the last call, 0 otherwise
+ */
+
+int     epos_check_boot (EPOS_drive_t * epos, int idx) {
+    
+    UNS8    boots = epos->can[idx].boots;
     
+    if (boots == epos->rt[idx].boots)
+        return 0;
     
+    epos->rt[idx].boots = boots;
+    memset (epos->cold.profile_sent[idx], 0, sizeof (epos->cold.profile_sent[idx]));
+    epos_reset_homing (epos, idx);
     
+    return 1;
 }
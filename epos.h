@@ -47,8 +47,33 @@ typedef enum {
     PPM_Running = 0x01,
 } PPM_State_t;
 
+/*
+Homing Mode state machine states
+Home request: ___|```````````````````|___ (ControlWord bit 4)
+Homing      : ______|````````````````|___ (StatusWord bit 12 low, then 12 + 10 high when attained)
+*/
+typedef enum {
+    HMM_Idle = 0x00,
+    HMM_Queue,          // homing requested, waiting for the SDO channel
+    HMM_Config,         // homing method / offset / speeds being written
+    HMM_Start,          // waiting for the drive to be ready to start
+    HMM_Running,        // homing operation started (ControlWord bit 4 set)
+    HMM_Done,           // homing attained
+    HMM_Error,          // homing error or configuration refused
+} HMM_State_t;
+
+/* homing configuration, written with background SDOs before each homing */
+typedef struct {
+    INTEGER8    method;         // 0x6098 homing method
+    INTEGER32   offset;         // 0x607C home offset
+    UNS32       speed_switch;   // 0x6099/1 speed for switch search, 0 leaves the drive value
+    UNS32       speed_zero;     // 0x6099/2 speed for zero search, 0 leaves the drive value
+    UNS32       accel;          // 0x609A homing acceleration, 0 leaves the drive value
+} EPOS_homing_t;
+
 /* Maxon EPOS drive modes */
 typedef enum {
+    EPOS_MODE_CSP = 8,  // cyclic synchronous position (DS-402, EPOS4 and others)
     EPOS_MODE_HMM = 6,  // homing
     EPOS_MODE_PVM = 3,  // profile velocity
     EPOS_MODE_PPM = 1,  // profile position
@@ -60,6 +85,113 @@ typedef enum {
     EPOS_MODE_SDM = -6, // step/direction mode
 } EPOS_DriveMode_t;
 
+/*
+    Process image exchanged between the HAL update() (RT) and the CanFestival threads
+
+    Each direction has one writer and one reader. The writer fills the buffer not
+    currently published and then bumps the sequence. The reader copies the published
+    buffer and retries if the sequence moved meanwhile. Neither side takes EnterMutex()
+    and the reader never waits on a preempted writer (the published buffer is stable)
+*/
+typedef struct {
+    UNS16       ControlWord;
+    INTEGER8    OperationMode;
+    INTEGER32   PositionDemandValue;
+    INTEGER32   VelocityDemandValue;
+    UNS16       DigitalOut;
+    INTEGER32   VelocityOffset;
+    INTEGER16   TorqueOffset;
+    INTEGER32   TargetVelocity;
+} EPOS_out_image_t;
+
+/* the command image fields, as bits in the changed mask returned by epos_load_outputs */
+typedef enum {
+    EPOS_OUT_CW     = 0,    // ControlWord, 0x5040
+    EPOS_OUT_MODE   = 1,    // OperationMode, 0x5060
+    EPOS_OUT_POS    = 2,    // PositionDemandValue, 0x4062
+    EPOS_OUT_VEL    = 3,    // VelocityDemandValue, 0x406B
+    EPOS_OUT_DOUT   = 4,    // DigitalOut, 0x4078
+    EPOS_OUT_VOFF   = 5,    // VelocityOffset, 0x50B1
+    EPOS_OUT_TOFF   = 6,    // TorqueOffset, 0x50B2
+    EPOS_OUT_TVEL   = 7,    // TargetVelocity, 0x50FF
+    EPOS_OUT_FIELDS,
+} EPOS_out_field_t;
+
+#define EPOS_OUT_ALL    ((1 << EPOS_OUT_FIELDS) - 1)
+
+/* the TPDOs a command image field is mapped in (reverse PDO map) */
+#define EPOS_TPDO_MAP_MAX   8
+
+typedef struct {
+    UNS8    count;
+    UNS16   pdo[EPOS_TPDO_MAP_MAX];     // TPDO numbers (0 = 0x1800, up to 0x1FF)
+} EPOS_pdo_list_t;
+
+typedef struct {
+    UNS16       StatusWord;
+    INTEGER8    OperationModeDisplay;
+    INTEGER32   PositionActualValue;
+    INTEGER32   VelocityActualValue;
+    UNS16       DigitalIn;
+} EPOS_in_image_t;
+
+#define DECLARE_DBUF(DBUF_TYPE,IMAGE_TYPE) \
+typedef struct {\
+    volatile UNS32  seq;\
+    IMAGE_TYPE      buf[2];\
+} DBUF_TYPE
+
+DECLARE_DBUF(EPOS_out_dbuf_t, EPOS_out_image_t);
+DECLARE_DBUF(EPOS_in_dbuf_t, EPOS_in_image_t);
+
+/* publish a new image (writer side) */
+#define DBUF_WRITE(DB, SRC) do {\
+    UNS32 _seq = (DB).seq;\
+    (DB).buf[(_seq + 1) & 1] = (SRC);\
+    __sync_synchronize();\
+    (DB).seq = _seq + 1; } while (0)
+
+/* get a consistent copy of the published image (reader side) */
+#define DBUF_READ(DB, DST) do {\
+    UNS32 _seq;\
+    do {\
+        _seq = (DB).seq;\
+        __sync_synchronize();\
+        (DST) = (DB).buf[_seq & 1];\
+        __sync_synchronize();\
+    } while (_seq != (DB).seq); } while (0)
+
+/*
+    ControlWord requests from the status word callback to update()
+    Low word has the bits to set, high word the bits to clear. The latest request for a bit wins
+*/
+#define CW_REQ_SET(req)     ((UNS16)((req) & 0xFFFF))
+#define CW_REQ_CLEAR(req)   ((UNS16)((req) >> 16))
+
+/*
+    PDO layout. The process objects mapped in each PDO of a drive
+*/
+#define EPOS_PDO_MAX        4       // PDOs per drive and direction
+#define EPOS_PDO_MAX_MAP    8       // objects per PDO
+
+typedef struct {
+    const char  *name;          // name used in the object lists (epos_set_pdo_map)
+    UNS16       master_idx;     // master object, array indexed by drive (subindex = drive + 1)
+    UNS32       slave_obj;      // default slave object, index << 8 | subindex
+    UNS8        bits;           // size in bits
+} EPOS_pdo_object_t;
+
+typedef struct {
+    UNS8    count;
+    UNS8    object[EPOS_PDO_MAX_MAP];       // the objects, index in the object table
+    UNS32   slave_obj[EPOS_PDO_MAX_MAP];    // the slave objects, index << 8 | subindex
+} EPOS_pdo_frame_t;
+
+typedef struct {
+    UNS8                count;              // PDOs used
+    EPOS_pdo_frame_t    frame[EPOS_PDO_MAX];
+} EPOS_pdo_layout_t;
+
 typedef struct {
     UNS16   idx;
     UNS8    sub;
@@ -76,123 +208,271 @@ typedef enum {
     SDO_FINISH,
 } SDO_transfer_type_t;
 
+/*
+    Batch states. The RT side owns IDLE -> QUEUED, the CAN timer thread owns the rest,
+    so the handoff needs no mutex, only ordered stores
+*/
+typedef enum {
+    SDO_BATCH_IDLE,         // free, the RT side can fill it in
+    SDO_BATCH_QUEUED,       // filled in, waiting for the timer thread
+    SDO_BATCH_BUSY,         // transfers on the bus
+    SDO_BATCH_DONE,         // finished, waiting for room in the completion ring
+} SDO_batch_state_t;
+
 typedef struct {
     SDO_item_t  items[MAX_SDO_ITEMS];
     int         count;
     int         cursor;
-    UNS8        state;
+    volatile UNS8
+                state;
     UNS32       error;
+    UNS32       tag;        // caller cookie, returned with the completion
+    UNS32       ticks;      // SDO cycles spent on the current item
+    UNS8        retry;      // the current item could not be started yet
     SDO_transfer_type_t
                 type;
 } SDO_transfer_t;
 
+/* SDO batch tags, to route the completions back to their users */
+#define EPOS_SDO_TAG_PROFILE    0x01
+#define EPOS_SDO_TAG_HOMING     0x02
+
+/* motion profile parameters, written to the drive with background SDOs */
+typedef enum {
+    EPOS_PROFILE_VEL,       // 0x6081 profile velocity
+    EPOS_PROFILE_ACCEL,     // 0x6083 profile acceleration
+    EPOS_PROFILE_DECEL,     // 0x6084 profile deceleration
+    EPOS_PROFILE_FERR,      // 0x6065 max following error
+    EPOS_PROFILE_COUNT,
+} EPOS_profile_t;
+
+/* one finished batch, as reported to the RT side */
+typedef struct {
+    UNS8        idx;        // drive index
+    UNS8        count;      // items transferred successfully
+    SDO_transfer_type_t
+                type;
+    UNS32       error;      // OD_SUCCESSFUL or the SDO abort code
+    UNS32       tag;
+} SDO_completion_t;
+
+/* single producer (CAN timer thread) / single consumer (RT) ring, power of 2 */
+#define SDO_RING_SIZE   16
+
+typedef struct {
+    SDO_completion_t    entry[SDO_RING_SIZE];
+    volatile unsigned   head;       // written by the producer
+    volatile unsigned   tail;       // written by the consumer
+} SDO_ring_t;
+
+/*
+    Per drive hot data, grouped by writer so each group sits in its own cache line(s)
+    and the RT and CAN threads never write to the same line
+*/
+
+/* private to update() (RT side) */
+typedef struct {
+    EPOS_out_image_t    out;            // commands being built by update()
+    EPOS_in_image_t     in;             // feedback snapshot for the current cycle
+    UNS32               cw_merged;      // CW requests merged in the current cycle
+    // EPOS_State is the slave state. Used internally by the drive routines
+    UNS16               EPOS_State;
+    PPM_State_t         EPOS_PPMState;
+    // PPM set-point queue, producer side
+    volatile unsigned   ppm_head;
+    UNS32               ppm_overflows;  // set-points refused, queue full
+    HMM_State_t         hmm_state;
+    UNS8                boots;          // slave bootups handled, see EPOS_drive_can_t
+} __attribute__((aligned(EPOS_CACHE_LINE))) EPOS_drive_rt_t;
+
+/* published by update(), read by the CAN side */
+typedef struct {
+    EPOS_out_dbuf_t     out_shared;
+    volatile UNS8       quick_stop;     // quick stop requested, for the status word callback
+} __attribute__((aligned(EPOS_CACHE_LINE))) EPOS_drive_cmd_t;
+
+/* written by the CAN side (PDO callbacks, PDO sender) */
+typedef struct {
+    EPOS_in_dbuf_t      in_shared;      // written by the PDO callbacks
+    volatile UNS32      cw_request;     // written by the status word callback
+    UNS8                tx_force;       // send all the drive TPDOs on the next send
+    // PPM set-point queue, consumer side
+    volatile unsigned   ppm_tail;
+    INTEGER32           ppm_target;     // set-point being handed to the drive
+    UNS8                ppm_pending;    // new set-point sent, waiting for the acknowledge
+    UNS8                hmm_started;    // the drive reported homing in progress since bit 4 went out
+    UNS8                rx_last;        // feedback objects closing an RPDO (1 << _in_objects entry), where the input image is published
+    volatile UNS8       boots;          // slave bootups seen (NMT reset or reboot), the drive lost what was written to it
+} __attribute__((aligned(EPOS_CACHE_LINE))) EPOS_drive_can_t;
+
+/*
+    Configuration and diagnostics, not touched by the per cycle paths
+*/
 typedef struct {
-    // the CanFestival object
-    CO_Data*    d;
-    
-    // the list of the EPOS slaves we control
-    UNS8        epos_slaves[EPOS_MAX_DRIVES];
-    UNS8        epos_slave_count;
-    
     // holds the DCF data for initializing the nodes
     dcfset_t    dcf_data;
+
+    // PDO layouts, same for all the drives
+    EPOS_pdo_layout_t   tx_layout;          // master TPDOs / slave RPDOs
+    EPOS_pdo_layout_t   rx_layout;          // master RPDOs / slave TPDOs
+    char                pdo_slave_dcf;      // add the slave PDO mapping to the slave DCF
     
     // holds the drive errors signalled via EMCY
-    UNS32       slave_err[EPOS_MAX_DRIVES][EPOS_MAX_ERRORS+1];
-    
-    // EPOS_State is the slave state. Used internally by the drive routines
-    UNS16       EPOS_State[EPOS_MAX_DRIVES];
-    
-    PPM_State_t EPOS_PPMState[EPOS_MAX_DRIVES];
-    
-    // enabled or disabled
-    char        drive_enabled;
-    // initialised or not
-    char        drive_initialised;
-    // state of the drive
-    char        drive_state;
-
-        
-    // CNC interface
-    char        enable[EPOS_MAX_DRIVES];         // true - drive enabled, false - drive disabled
-    int         control_type[EPOS_MAX_DRIVES];   // 0 - position control, 1 - velocity control
-    int         maxvel[EPOS_MAX_DRIVES];	     // maximal drive velocity
-    int         maxaccel[EPOS_MAX_DRIVES];       // maximal drive acceleration
-
-    int         counts[EPOS_MAX_DRIVES];         // raw encoder / position from the drive
-    float       position_scale[EPOS_MAX_DRIVES]; // scale for positioning. position = counts / position-scale
+    UNS32       (*slave_err)[EPOS_MAX_ERRORS+1];
 
-    float       position_cmd[EPOS_MAX_DRIVES];   // position command (for position control)
-    float       velocity_cmd[EPOS_MAX_DRIVES];   // velocity command (for velocity control)
+    // motion profile
+    UNS32       (*profile)[EPOS_PROFILE_COUNT];         // profile values being written (SDO data)
+    UNS32       (*profile_sent)[EPOS_PROFILE_COUNT];    // last values written, 0 for none
+    UNS8        *profile_queued;                        // EPOS_profile_t bits in the batch
 
-    float       position_fb[EPOS_MAX_DRIVES];    // position feedback
-    float       velocity_fb[EPOS_MAX_DRIVES];    // velocity feedback
+    // homing
+    EPOS_homing_t   *homing_req;        // homing configuration requested
+    EPOS_homing_t   *homing;            // homing configuration being written (SDO data)
 
-    char        fault[EPOS_MAX_DRIVES];          // drive is faulted
+    // SDO transfer data, per node
+    SDO_transfer_t  *sdos;
+    // finished SDO batches
+    SDO_ring_t      sdo_ring;
+} EPOS_cold_t;
 
-    // extra stuff
+/*
+    The drive object arrays of a master OD, indexed by drive (subindex - 1). Each bus has
+    its own OD, so the arrays are found at load time instead of using the OD variables
+*/
+typedef struct {
+    UNS16       *ControlWord;               // 0x5040
+    UNS16       *StatusWord;                // 0x5041
+    INTEGER8    *OperationMode;             // 0x5060
+    INTEGER8    *OperationModeDisplay;      // 0x5061
+    INTEGER32   *PositionActualValue;       // 0x5064
+    INTEGER32   *VelocityActualValue;       // 0x506C
+    INTEGER32   *PositionDemandValue;       // 0x4062
+    INTEGER32   *VelocityDemandValue;       // 0x406B
+    UNS16       *DigitalIn;                 // 0x4071
+    UNS16       *DigitalOut;                // 0x4078
+    INTEGER32   *VelocityOffset;            // 0x50B1
+    INTEGER16   *TorqueOffset;              // 0x50B2
+    INTEGER32   *TargetVelocity;            // 0x50FF
+} EPOS_od_t;
 
-    char        home[EPOS_MAX_DRIVES];           // set to high to initialise homing
-    char        homing_done[EPOS_MAX_DRIVES];    // set to high when drive is homed
+/*
+    The EPOS context, one per bus (master OD). The CanFestival callbacks find it from
+    their CO_Data (epos_ctx), the other routines get it passed
+*/
+typedef struct {
+    // per drive hot data, allocated at load time for the configured drives
+    EPOS_drive_rt_t     *rt;
+    EPOS_drive_cmd_t    *cmd;
+    EPOS_drive_can_t    *can;
 
-    char        lock[EPOS_MAX_DRIVES];           // engage the lock brake
-    char        is_locked[EPOS_MAX_DRIVES];      // lock brake is engaged and axis is confirmed locked
+    // the CanFestival object, one per bus
+    CO_Data*    d;
+    // the drive object arrays in the OD of the bus
+    EPOS_od_t   od;
+    
+    // the list of the EPOS slaves we control
+    UNS8        *epos_slaves;
+    UNS8        epos_slave_count;
+    // how many drives the per drive data is allocated for, never more than the OD has room for
+    UNS8        epos_max_drives;
 
-    // GPIO pins
-    char        home_sw_pin[EPOS_MAX_DRIVES];    // home switch pin
-    char        enable_pin[EPOS_MAX_DRIVES];     // enable pin
-    char        in_a_pin[EPOS_MAX_DRIVES];       // IN A
-    char        in_b_pin[EPOS_MAX_DRIVES];       // IN B
-    char        in_c_pin[EPOS_MAX_DRIVES];       // IN C
-    char        in_d_pin[EPOS_MAX_DRIVES];       // IN D
-    char        in_e_pin[EPOS_MAX_DRIVES];       // IN E
-    char        in_f_pin[EPOS_MAX_DRIVES];       // IN F
+    // 1 - the status word callback only posts the ControlWord requests, sent by the next
+    // epos_send_outputs. 0 - the callback sends them right away (no cyclic sender present)
+    char        cw_deferred;
 
-    float       in_ana1[EPOS_MAX_DRIVES];        // Analog 1 in
-    float       in_ana2[EPOS_MAX_DRIVES];        // Analog 2 in
+    // TPDOs carrying each command image field, per drive. Built from the master PDO mapping
+    EPOS_pdo_list_t     (*tx_pdo_map)[EPOS_OUT_FIELDS];
 
-    char        out_a_pin[EPOS_MAX_DRIVES];      // OUT A
-    char        out_b_pin[EPOS_MAX_DRIVES];      // OUT B
-    char        out_c_pin[EPOS_MAX_DRIVES];      // OUT C
-    char        out_d_pin[EPOS_MAX_DRIVES];      // OUT D
+    // PPM set-point queues, 0 depth for none (update() drives the handshake)
+    INTEGER32   (*ppm_points)[EPOS_PPM_QUEUE_MAX];
+    UNS16       ppm_depth;
+    // 1 - every set-point goes to the drive set-point buffer, in order. 0 - change set
+    // immediately, only the newest queued set-point is sent (the drive drops the others anyway)
+    char        ppm_buffered;
 
-    
-    // SDO transfer data, per node
-    SDO_transfer_t  sdos[EPOS_MAX_DRIVES];
+    // configuration and diagnostics
+    EPOS_cold_t cold;
 } EPOS_drive_t;
 
-extern EPOS_drive_t EPOS_drive;
-
-int     epos_initialize_master (CO_Data * d, const char * dcf_file);
-int     epos_setup_sdo (UNS8 slaveid, int idx);
-int     epos_setup_rx_pdo (UNS8 slaveid, int idx);
-int     epos_setup_tx_pdo (UNS8 slaveid, int idx);
-int     epos_add_slave (UNS8 slaveid);
+/* the EPOS context of a master OD, a new CO_Data takes a free one. NULL if all are taken */
+EPOS_drive_t *  epos_ctx (CO_Data * d);
+
+EPOS_drive_t *  epos_initialize_master (CO_Data * d, const char * dcf_file, int drives);
+int     epos_setup_sdo (EPOS_drive_t * epos, UNS8 slaveid, int idx);
+int     epos_setup_rx_pdo (EPOS_drive_t * epos, UNS8 slaveid, int idx);
+int     epos_setup_tx_pdo (EPOS_drive_t * epos, UNS8 slaveid, int idx);
+int     epos_map_tx_pdo (EPOS_drive_t * epos, int idx);
+int     epos_map_rx_pdo (EPOS_drive_t * epos, int idx);
+int     epos_set_pdo_map (EPOS_drive_t * epos, const char *tx, const char *rx);
+int     epos_add_slave (EPOS_drive_t * epos, UNS8 slaveid);
+int     epos_set_interpolation_period (EPOS_drive_t * epos, UNS8 slaveid, UNS32 period_us);
+
+// process image routines
+void    epos_read_inputs (EPOS_drive_t * epos, int idx);         // RT side, start of cycle
+void    epos_publish_outputs (EPOS_drive_t * epos, int idx);     // RT side, end of cycle
+UNS8    epos_load_outputs (EPOS_drive_t * epos, int idx);        // CAN side, mutex held, before sending PDOs. Returns the changed fields
+void    epos_send_drive_outputs (EPOS_drive_t * epos, int idx); // CAN side, mutex held, load and send the changed PDOs of a drive
+void    epos_send_outputs (EPOS_drive_t * epos);    // CAN side, mutex held, load all and send the changed PDOs
+
+// asynchronous SDO batches. The RT side fills in and queues, the CAN timer thread runs them
+int     _init_sdo_transfer (EPOS_drive_t * epos, int idx);       // RT side, returns 0 while the previous batch is in flight
+int     _add_sdo_transfer (EPOS_drive_t * epos, int idx, UNS16 obj, UNS8 sub, UNS32 size, void *data);
+int     _execute_sdo_transfer (EPOS_drive_t * epos, int idx, SDO_transfer_type_t type, UNS32 tag);
+int     _get_sdo_transfer_result (EPOS_drive_t * epos, SDO_completion_t *result);    // RT side, pops one completion
+void    epos_sdo_start (CO_Data * d);       // CAN side, mutex held, arms the SDO cycle
+void    epos_sdo_cycle (CO_Data * d, UNS32 id);     // CAN timer alarm
+
+// motion profile, RT side
+int     epos_update_profile (EPOS_drive_t * epos, int idx, const UNS32 *values);    // queues the changed values, 0 for none / busy
+int     epos_profile_done (EPOS_drive_t * epos, const SDO_completion_t *result);    // returns the failed EPOS_profile_t, -1 if none
+
+// slave restarts
+void    epos_slave_booted (EPOS_drive_t * epos, UNS8 slaveid);     // CAN side, bootup frame received
+int     epos_check_boot (EPOS_drive_t * epos, int idx);            // RT side, 1 if the slave booted since the last call
 
 // EPOS PPM routines
-void    update_PPM (int idx);
-int     epos_can_do_PPM (int idx);
-int     epos_do_move_PPM (int idx, INTEGER32 position);
+void    update_PPM (EPOS_drive_t * epos, int idx);
+int     epos_can_do_PPM (EPOS_drive_t * epos, int idx);
+int     epos_do_move_PPM (EPOS_drive_t * epos, int idx, INTEGER32 position);
+int     epos_set_ppm_queue (EPOS_drive_t * epos, int depth, int buffered);
+int     epos_queue_PPM (EPOS_drive_t * epos, int idx, INTEGER32 position);     // RT side, 0 if the queue is full
+int     epos_PPM_fill (EPOS_drive_t * epos, int idx);                        // RT side, set-points waiting
+
+// EPOS PVM routines
+void    epos_set_velocity (EPOS_drive_t * epos, int idx, INTEGER32 velocity);
+void    epos_set_target_velocity (EPOS_drive_t * epos, int idx, INTEGER32 velocity);
+int     epos_velocity_reached (EPOS_drive_t * epos, int idx);
+
+// EPOS HMM routines, RT side
+int     epos_start_homing (EPOS_drive_t * epos, int idx, const EPOS_homing_t *cfg);
+void    epos_stop_homing (EPOS_drive_t * epos, int idx);
+void    epos_reset_homing (EPOS_drive_t * epos, int idx);     // stops and goes back to HMM_Idle, homed is lost
+void    update_HMM (EPOS_drive_t * epos, int idx);
+void    epos_homing_done (EPOS_drive_t * epos, const SDO_completion_t *result);
+HMM_State_t epos_get_homing (EPOS_drive_t * epos, int idx);
 
 // EPOS generic routines
-void    epos_set_absolute (int idx);
-void    epos_set_relative (int idx);
-void    epos_set_continuous (int idx);
-void    epos_set_segmented (int idx);
-void    epos_halt (int idx);
-void    epos_execute (int idx);
-int     epos_in_position (int idx);
+void    epos_set_absolute (EPOS_drive_t * epos, int idx);
+void    epos_set_relative (EPOS_drive_t * epos, int idx);
+void    epos_set_continuous (EPOS_drive_t * epos, int idx);
+void    epos_set_segmented (EPOS_drive_t * epos, int idx);
+void    epos_set_buffered (EPOS_drive_t * epos, int idx);
+void    epos_halt (EPOS_drive_t * epos, int idx);
+int     epos_quick_stop (EPOS_drive_t * epos, int idx, int active);      // returns 1 if the ControlWord changed
+int     epos_quick_stop_active (EPOS_drive_t * epos, int idx);
+void    epos_execute (EPOS_drive_t * epos, int idx);
+int     epos_in_position (EPOS_drive_t * epos, int idx);
 
 // EPOS drive control
-void    epos_enable_drive (int idx);
-void    epos_disable_drive (int idx);
-void    epos_fault_reset (int idx);
-int     epos_drive_operational (int idx);
-int     epos_drive_faulted (int idx);
-int     epos_drive_disabled (int idx);
-
-void    epos_set_mode (int idx, EPOS_DriveMode_t);
-EPOS_DriveMode_t    epos_get_mode (int idx);
+void    epos_enable_drive (EPOS_drive_t * epos, int idx);
+void    epos_disable_drive (EPOS_drive_t * epos, int idx);
+void    epos_fault_reset (EPOS_drive_t * epos, int idx);
+int     epos_drive_operational (EPOS_drive_t * epos, int idx);
+int     epos_drive_faulted (EPOS_drive_t * epos, int idx);
+int     epos_drive_disabled (EPOS_drive_t * epos, int idx);
+
+void    epos_set_mode (EPOS_drive_t * epos, int idx, EPOS_DriveMode_t);
+EPOS_DriveMode_t    epos_get_mode (EPOS_drive_t * epos, int idx);
 
 
 
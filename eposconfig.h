@@ -23,6 +23,13 @@ Configuration defines
 
 #define EPOS_ERR(...)    eprintf(__VA_ARGS__)
 
+/* the per drive data is allocated at load time. From the HAL shared memory in the module */
+#if defined(RTAPI)
+#define EPOS_ALLOC(size) hal_malloc (size)
+#else
+#define EPOS_ALLOC(size) malloc (size)
+#endif
+
 /*
     Bit routines
 */
@@ -43,9 +50,34 @@ Configuration defines
 
 // max time in us for a boot (10 seconds?)
 #define NODE_BOOT_TIME 10*1000*1000
+// max time in us to wait for the first heartbeat of a booting slave
+#define NODE_HB_WAIT_TIME 2*1000*1000
+// the boot master advances when a slave machine finishes, this is only the fallback poll (ms)
+#define DS302_MASTER_POLL_MS 1000
+// node guarding: all guarded slaves share one timer wheel. Tick in ms and slot count (power of 2)
+#define DS302_NG_TICK_MS        10
+#define DS302_NG_WHEEL_SLOTS    64
+// heartbeat statistics: the consumer time needs this many wheel ticks, and the RT reads retry this often
+#define DS302_HB_MIN_TICKS      4
+#define DS302_HB_READ_TRIES     4
 
-/* maximum number of drives supported */
-#define EPOS_MAX_DRIVES     5
+/* CAN buses the module can run. Each needs its own master OD (EPOScontrol, EPOScontrol1, ...),
+the Makefile generates them (CAN_BUSES) */
+#ifndef EPOS_CAN_BUSES
+#define EPOS_CAN_BUSES      1
+#endif
+/* maximum number of slaves accepted in the module params (CANopen node IDs). The drive
+count is also limited by the room for drives in the OD (EPOScontrol.od drive object
+arrays, client SDOs and PDOs), see od_drives.py and EPOS_DRIVES in the Makefile */
+#define EPOS_MAX_SLAVES     127
+/* asynchronous SDO batches: how often the timer thread services them, and how long
+a single transfer may take before it is aborted */
+#define EPOS_SDO_CYCLE_MS       5
+#define EPOS_SDO_TIMEOUT_MS     500
+/* maximum depth of the PPM set-point queue, per drive */
+#define EPOS_PPM_QUEUE_MAX  64
+/* cache line size, the per drive hot data is aligned to it */
+#define EPOS_CACHE_LINE     64
 /* maximum number of errors per drive */
 #define EPOS_MAX_ERRORS     32
 
@@ -55,6 +55,9 @@ unsigned int bootup = 1;
 
 unsigned int debug = 0;
 
+// the EPOS context of the bus
+EPOS_drive_t    *epos = NULL;
+
 uint64_t    almClock = 0;
 uint64_t    almClock2 = 0;                 
 
@@ -364,6 +367,16 @@ void timer_play2(CO_Data* d, UNS32 id)
 
 int     ds302_nl_keepalive_nodes_present(CO_Data* d);
 
+/* publishes the local command image for drive 0 and sends it */
+static void send_outputs ()
+{
+    epos_publish_outputs (epos, 0);
+
+    EnterMutex();
+    epos_send_outputs (epos);
+    LeaveMutex();
+}
+
 /****************************************************************************/
 /***************************  MAIN  *****************************************/
 /****************************************************************************/
@@ -378,9 +391,13 @@ int main(int argc,char **argv)
     // THE STUPID MASTER ID SET WILL REWRITE THE SDOs/PDOs
     setNodeId(&EPOScontrol_Data, 0x7F);
 
-    epos_initialize_master (&EPOScontrol_Data, "dcfdata.txt");
-    display_dcf_set (&EPOS_drive.dcf_data);
-    epos_add_slave (0x01);
+    epos = epos_initialize_master (&EPOScontrol_Data, "dcfdata.txt", 1);
+    if (!epos) {
+        eprintf ("Unable to set up the master\n");
+        return 1;
+    }
+    display_dcf_set (&epos->cold.dcf_data);
+    epos_add_slave (epos, 0x01);
     
     // load the DCF configuration for the master node before starting the timers and such
     ds302_load_dcf_local (&EPOScontrol_Data);
@@ -435,7 +452,7 @@ int main(int argc,char **argv)
 	
     ds302_init (&EPOScontrol_Data);
     // profile position mode
-    OperationMode[0] = 1;
+    epos_set_mode (epos, 0, EPOS_MODE_PPM);
 
 	EnterMutex();
 	ds302_start (&EPOScontrol_Data);
@@ -451,25 +468,23 @@ int main(int argc,char **argv)
 	eprintf ("EPOS ready for operation!\n");
 	eprintf ("Setting PPM params and enable drive\n");
 
-	EnterMutex();
+    epos_read_inputs (epos, 0);
 
-    epos_set_continuous (0);
-    //epos_set_segmented(0);
-    epos_set_absolute (0);
-    epos_execute (0);
+    epos_set_continuous (epos, 0);
+    //epos_set_segmented(epos, 0);
+    epos_set_absolute (epos, 0);
+    epos_execute (epos, 0);
 
 	///SET_BIT(ControlWord[0], 5); // 1 start immmediately, interrupt in progress if any. 0 finish previous first
 	///CLEAR_BIT(ControlWord[0], 6); // 0 absolute, 1 relative
 	///CLEAR_BIT(ControlWord[0], 8); // 0 execute, 1 halt
 
-    VelocityDemandValue[0] = 1000;
+    epos->rt[0].out.VelocityDemandValue = 1000;
 
-    epos_enable_drive (0);
-    epos_set_mode (0, EPOS_MODE_PVM);
+    epos_enable_drive (epos, 0);
+    epos_set_mode (epos, 0, EPOS_MODE_PVM);
     // load values to the drive
-    sendPDOevent(&EPOScontrol_Data);
-
-	LeaveMutex();
+    send_outputs ();
 
     eprintf ("PPM parameters done, ensuring drive is enabled\n");
 
@@ -508,24 +523,22 @@ int main(int argc,char **argv)
 
     int     faulted = 0;
     // wait to become operational
-    while (!epos_drive_operational(0)) {
-        if (epos_drive_faulted(0)) {
+    epos_read_inputs (epos, 0);
+    while (!epos_drive_operational(epos, 0)) {
+        if (epos_drive_faulted(epos, 0)) {
             // try to clear fault
             eprintf ("Faulted, try to clear fault ()\n");
-            EnterMutex();
-            epos_fault_reset(0);
-            sendPDOevent(&EPOScontrol_Data);
-            LeaveMutex();
+            epos_fault_reset(epos, 0);
+            send_outputs ();
             faulted++;
-        } else if (epos_drive_disabled(0) && faulted) {
+        } else if (epos_drive_disabled(epos, 0) && faulted) {
             // we end up here after a fault reset
             printf ("Fault cleared, try to start ()\n");
-            EnterMutex();
-            epos_enable_drive(0);
-            sendPDOevent(&EPOScontrol_Data);
-            LeaveMutex();        
+            epos_enable_drive(epos, 0);
+            send_outputs ();
         }
         sleep_ms (SLEEP_TIME);
+        epos_read_inputs (epos, 0);
     }
 
     eprintf ("Drive is ready for operation\n");
@@ -541,19 +554,19 @@ int main(int argc,char **argv)
         if (cycle>CYCLES)
             break;
 
-        if (epos_drive_faulted(0) || epos_drive_disabled(0))    // bail out on error
+        if (epos_drive_faulted(epos, 0) || epos_drive_disabled(epos, 0))    // bail out on error
             break;
 
-        EnterMutex();
-        if (epos_do_move_PPM(0, position)) {
+        if (epos_do_move_PPM(epos, 0, position)) {
             // increment target
             position += STEP_SIZE;
             // increment cycle
             cycle++;
             //eprintf ("Completed cycle %d\n", cycle);
         }
-        LeaveMutex();
+        send_outputs ();
         sleep_ms (SLEEP_TIME);
+        epos_read_inputs (epos, 0);
     };
 
     // decrement the position to account for the overshoot
@@ -561,8 +574,10 @@ int main(int argc,char **argv)
     eprintf ("Forward done, final position executed %ld, cycle=%d, actual position=%ld\n", position, cycle, PositionActualValue[0]);
     eprintf ("Waiting for moves to complete\n");
 
-    while (!epos_in_position(0))
+    while (!epos_in_position(epos, 0)) {
         sleep_ms (SLEEP_TIME);
+        epos_read_inputs (epos, 0);
+    }
     eprintf ("Servo in position, actual position=%ld\n", PositionActualValue[0]);
 
     sleep_ms(SETTLE_TIME);
@@ -574,19 +589,19 @@ int main(int argc,char **argv)
         if (cycle <= 0)
             break;
 
-        if (epos_drive_faulted(0) || epos_drive_disabled(0))    // bail out on error
+        if (epos_drive_faulted(epos, 0) || epos_drive_disabled(epos, 0))    // bail out on error
             break;
 
-        EnterMutex();
-        if (epos_do_move_PPM(0, position)) {
+        if (epos_do_move_PPM(epos, 0, position)) {
             // move was OK, increment the value
             position -= STEP_SIZE;
             // decrement cycle
             cycle--;
             //eprintf ("Completed cycle %d\n", cycle);
         }
-        LeaveMutex();
+        send_outputs ();
         sleep_ms (SLEEP_TIME);
+        epos_read_inputs (epos, 0);
     };
     // increment the position to account for the overshoot
     position += STEP_SIZE;
@@ -594,8 +609,10 @@ int main(int argc,char **argv)
 
     eprintf ("Waiting for moves to complete\n");
 
-    while (!epos_in_position(0))
+    while (!epos_in_position(epos, 0)) {
         sleep_ms (SLEEP_TIME);
+        epos_read_inputs (epos, 0);
+    }
     eprintf ("Servo in position, actual position=%ld\n", PositionActualValue[0]);
 
     sleep_ms(SETTLE_TIME);
@@ -603,10 +620,9 @@ int main(int argc,char **argv)
 	//pause();
 	eprintf("Finishing.\n");
 
-    EnterMutex();    
-    epos_disable_drive (0);
-    sendPDOevent(&EPOScontrol_Data);
-    LeaveMutex();
+    epos_read_inputs (epos, 0);
+    epos_disable_drive (epos, 0);
+    send_outputs ();
     sleep_ms(SETTLE_TIME);
 
     pause();
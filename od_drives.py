@@ -0,0 +1,208 @@
+#!/usr/bin/env python
+#
+# Sizes the master OD (EPOScontrol.od) for a number of drives
+#
+# Each drive needs:
+#   - one entry in each of the drive object arrays (0x4062 ... 0x50FF)
+#   - a client SDO (0x1280 + drive)
+#   - EPOS_PDO_MAX RX and TX PDOs, communication and mapping parameters
+#     (0x1400 / 0x1600 / 0x1800 / 0x1A00 + drive * EPOS_PDO_MAX + n)
+#
+# The ranges are rebuilt for exactly the requested drives, the values already in
+# the OD are kept. Run it before objdictgen:
+#
+#   python od_drives.py EPOScontrol.od 20
+#   objdictgen.py EPOScontrol.od EPOScontrol.c
+#
+# With an output file and a node name it writes the master OD of another CAN bus.
+# objdictgen names the drive object arrays after the objects, so they get the node
+# name as a prefix, next to the <name>_Data the master is reached by:
+#
+#   python od_drives.py EPOScontrol.od 20 EPOScontrol1.od EPOScontrol1
+#
+
+import sys
+import xml.etree.ElementTree as ET
+
+# keep in sync with epos.h
+EPOS_PDO_MAX = 4        # PDOs per drive and direction
+EPOS_PDO_MAX_MAP = 8    # objects per PDO
+
+# the CANopen limits of the ranges
+MAX_SDO_CLIENTS = 0x80
+MAX_PDOS = 0x200
+
+DRIVE_OBJECTS = [0x4062, 0x406B, 0x4071, 0x4078,
+                 0x5040, 0x5041, 0x5060, 0x5061, 0x5064, 0x506C, 0x50B1, 0x50B2, 0x50FF]
+
+HEADER = '<?xml version="1.0"?>\n<!DOCTYPE PyObject SYSTEM "PyObjects.dtd">\n'
+
+
+class ODFile:
+
+    def __init__(self, path):
+        self.tree = ET.parse(path)
+        self.root = self.tree.getroot()
+        self.dictionary = self.attr('Dictionary')
+        self.next_id = max(int(e.get('id')) for e in self.root.iter() if e.get('id')) + 1
+
+    def attr(self, name):
+        for a in self.root.findall('attr'):
+            if a.get('name') == name:
+                return a
+        raise KeyError(name)
+
+    def new_id(self):
+        self.next_id += 1
+        return str(self.next_id)
+
+    def entries(self):
+        return dict((int(e.find('key').get('value')), e) for e in self.dictionary.findall('entry'))
+
+    def remove(self, index):
+        entry = self.entries().get(index)
+        if entry is not None:
+            if entry is self.dictionary[-1] and len(self.dictionary) > 1:
+                self.dictionary[-2].tail = entry.tail
+            self.dictionary.remove(entry)
+
+    def items(self, index):
+        entry = self.entries().get(index)
+        if entry is None:
+            return None
+        return entry.find('val')
+
+    def rename(self, name, indexes):
+        """ sets the node name, the mapping names of indexes get it as a prefix """
+        self.attr('Name').set('value', name)
+        for entry in self.attr('UserMapping').findall('entry'):
+            if int(entry.find('key').get('value')) not in indexes:
+                continue
+            for field in entry.iter('entry'):
+                if field.find('key').get('value') != 'name':
+                    continue
+                val = field.find('val')
+                # subindex 0 is not a variable
+                if val.get('value') == 'Number of Entries':
+                    continue
+                if val.get('value') is not None:
+                    val.set('value', name + '_' + val.get('value'))
+                else:
+                    val.text = name + '_' + val.text
+
+    def set(self, index, items):
+        """ creates the object or replaces its items, items are (type, value) pairs """
+        val = self.items(index)
+        if val is None:
+            # new objects go at the end of the dictionary, the way they were added
+            entry = ET.SubElement(self.dictionary, 'entry')
+            entry.text = '\n    '
+            key = ET.SubElement(entry, 'key', type='numeric', value=str(index))
+            key.tail = '\n    '
+            val = ET.SubElement(entry, 'val', type='list', id=self.new_id())
+            val.tail = '\n  '
+            if len(self.dictionary) > 1:
+                entry.tail = self.dictionary[-2].tail
+                self.dictionary[-2].tail = '\n  '
+            else:
+                entry.tail = '\n'
+        for item in list(val):
+            val.remove(item)
+        val.text = '\n    '
+        for t, v in items:
+            item = ET.SubElement(val, 'item', type=t, value=v)
+            item.tail = '\n      '
+        if len(val):
+            val.text = '\n      '
+            val[-1].tail = '\n    '
+
+    def resize(self, index, count, first=None):
+        """ keeps the first count items, pads with zeros (first for subindex 1) """
+        val = self.items(index)
+        items = [(i.get('type'), i.get('value')) for i in val] if val is not None else []
+        items = items[:count]
+        while len(items) < count:
+            items.append(first if first is not None and not items else numeric(0))
+        self.set(index, items)
+
+    def range(self, base, limit, count, size, first=None):
+        """ base .. base + count - 1 resized to size items, the rest of the range removed """
+        for index in range(base, base + limit):
+            if index < base + count:
+                self.resize(index, size, first)
+            else:
+                self.remove(index)
+
+    def write(self, path):
+        f = open(path, 'w')
+        f.write(HEADER + serialize(self.root) + '\n')
+        f.close()
+
+
+# the attribute order of the pickled OD (python 2 ElementTree does not keep it)
+ATTR_ORDER = ['name', 'module', 'class', 'type', 'value', 'id']
+
+
+def escape(text, quote=False):
+    text = text.replace('&', '&amp;').replace('<', '&lt;').replace('>', '&gt;')
+    if quote:
+        text = text.replace('"', '&quot;')
+    return text
+
+
+def serialize(elem):
+    attrs = sorted(elem.attrib.items(), key=lambda a: ATTR_ORDER.index(a[0]) if a[0] in ATTR_ORDER else len(ATTR_ORDER))
+    out = '<' + elem.tag + ''.join(' %s="%s"' % (k, escape(v, True)) for k, v in attrs)
+    if len(elem) == 0 and not elem.text:
+        out += ' />'
+    else:
+        # objdictedit writes a space before the end of the tags carrying an id, except for the root
+        if 'id' in elem.attrib and elem.tag != 'PyObject':
+            out += ' '
+        out += '>' + escape(elem.text or '')
+        out += ''.join(serialize(child) for child in elem)
+        out += '</' + elem.tag + '>'
+    return out + escape(elem.tail or '')
+
+
+def numeric(value):
+    return ('numeric', str(value))
+
+
+def cob_id(pattern, offset):
+    # the default COB-ID for the first 4 PDOs, disabled for the rest (as objdictedit creates them)
+    return ('string', '{True:"$NODEID+0x%%X%s"%%(base+%d),False:0x80000000}[base<4]' % (pattern, offset))
+
+
+def main():
+    if len(sys.argv) not in (3, 4, 5):
+        sys.stderr.write('usage: %s <od file> <drives> [output [node name]]\n' % sys.argv[0])
+        return 1
+
+    drives = int(sys.argv[2], 0)
+    if drives < 1 or drives > MAX_SDO_CLIENTS or drives * EPOS_PDO_MAX > MAX_PDOS:
+        sys.stderr.write('drives must be between 1 and %d\n' % (MAX_PDOS // EPOS_PDO_MAX))
+        return 1
+
+    od = ODFile(sys.argv[1])
+
+    for index in DRIVE_OBJECTS:
+        od.resize(index, drives)
+
+    od.range(0x1280, MAX_SDO_CLIENTS, drives, 3)
+
+    pdos = drives * EPOS_PDO_MAX
+    od.range(0x1400, MAX_PDOS, pdos, 6, cob_id('00', 2))
+    od.range(0x1600, MAX_PDOS, pdos, EPOS_PDO_MAX_MAP)
+    od.range(0x1800, MAX_PDOS, pdos, 6, cob_id('80', 1))
+    od.range(0x1A00, MAX_PDOS, pdos, EPOS_PDO_MAX_MAP)
+
+    if len(sys.argv) == 5:
+        od.rename(sys.argv[4], DRIVE_OBJECTS)
+
+    od.write(sys.argv[3] if len(sys.argv) >= 4 else sys.argv[1])
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())